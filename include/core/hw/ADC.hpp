@@ -9,7 +9,7 @@
 #include <core/hw/namespace.hpp>
 #include <core/hw/common.hpp>
 
-#include <functional>
+#include <core/hw/Delegate.hpp>
 
 #include "hal.h"
 
@@ -92,7 +92,7 @@ public:
      *
      */
     using SampleType      = adcsample_t;
-    using ChannelCallback = std::function<void(SampleType)>;
+    using ChannelCallback = Delegate<void(SampleType)>;
 
     virtual void
     start(
@@ -0,0 +1,109 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/hw/namespace.hpp>
+#include <core/hw/common.hpp>
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+NAMESPACE_CORE_HW_BEGIN
+
+#ifndef CORE_HW_DELEGATE_SIZE
+#define CORE_HW_DELEGATE_SIZE (2 * sizeof(void*))
+#endif
+
+template <typename _SIGNATURE, std::size_t _SIZE = CORE_HW_DELEGATE_SIZE>
+class Delegate;
+
+/*! \brief Non allocating callable wrapper
+ *
+ * Stores a function pointer or a trivially copyable functor (e.g. a lambda
+ * capturing a few pointers or values) inline, and calls it through a single
+ * indirection. An empty delegate calls a no-op returning a value initialized
+ * result, so invoking it needs no check.
+ *
+ * The delegate itself is trivially copyable, and it can be safely copied
+ * in ISR context.
+ *
+ * \tparam _SIGNATURE function signature
+ * \tparam _SIZE inline storage size
+ */
+template <typename _R, typename... _ARGS, std::size_t _SIZE>
+class Delegate<_R(_ARGS...), _SIZE>
+{
+public:
+    constexpr
+    Delegate() : _storage(), _invoker(&_empty) {}
+
+    constexpr
+    Delegate(
+        std::nullptr_t
+    ) : _storage(), _invoker(&_empty) {}
+
+    template <typename _F, typename = typename std::enable_if<!std::is_same<typename std::decay<_F>::type, Delegate>::value>::type>
+    Delegate(
+        _F f
+    ) : _storage()
+    {
+        static_assert(sizeof(_F) <= _SIZE, "Callable too large for the delegate storage");
+        static_assert(alignof(_F) <= alignof(Storage), "Callable alignment not supported by the delegate storage");
+        static_assert(std::is_trivially_copyable<_F>::value, "Callable must be trivially copyable");
+        static_assert(std::is_trivially_destructible<_F>::value, "Callable must be trivially destructible");
+
+        new (&_storage)_F(f);
+        _invoker = &_invoke<_F>;
+    }
+
+    inline _R
+    operator()(
+        _ARGS... args
+    ) const
+    {
+        return _invoker(&_storage, std::forward<_ARGS>(args)...);
+    }
+
+    /*! \brief Check if a callable is set
+     *
+     */
+    inline explicit
+    operator bool() const
+    {
+        return _invoker != &_empty;
+    }
+
+private:
+    using Storage = typename std::aligned_storage<_SIZE, alignof(void*)>::type;
+    using Invoker = _R (*)(const void*, _ARGS...);
+
+    Storage _storage;
+    Invoker _invoker;
+
+    template <typename _F>
+    static _R
+    _invoke(
+        const void* storage,
+        _ARGS... args
+    )
+    {
+        // The storage belongs to the delegate, mutable lambdas are allowed
+        return (*const_cast<_F*>(reinterpret_cast<const _F*>(storage)))(std::forward<_ARGS>(args)...);
+    }
+
+    static _R
+    _empty(
+        const void*,
+        _ARGS...
+    )
+    {
+        return _R();
+    }
+};
+
+NAMESPACE_CORE_HW_END
@@ -9,7 +9,11 @@
 #include <core/hw/namespace.hpp>
 #include <core/hw/common.hpp>
 
-#include <functional>
+#include <core/hw/Delegate.hpp>
+#include <core/hw/GPIO.hpp>
+#include <core/hw/Time.hpp>
+
+#include <atomic>
 
 #include "hal.h"
 
@@ -67,7 +71,7 @@ public:
     /*! \brief Callback
      *
      */
-    using Callback = std::function<void(uint32_t)>;
+    using Callback = Delegate<void(uint32_t)>;
 
     /*! \brief Interrupt edge selection
      *
@@ -128,6 +132,8 @@ class EXTChannel_:
 public:
     using EXT = _EXT;
 
+    static constexpr expchannel_t CHANNEL = _CH;
+
 public:
     static Callback callback_impl;
 
@@ -195,6 +201,20 @@ public:
         tmp.cb   = nullptr;
 
         extSetChannelMode(EXT::driver, _CH, &tmp);
+
+        callback_impl = nullptr;
+    }
+
+    /*! \brief Serve the channel interrupt
+     *
+     * To be used by EXTDispatcher_. Nothing is done without a callback.
+     */
+    static inline void
+    serve()
+    {
+        if (callback_impl) {
+            callback_impl(_CH);
+        }
     }
 
 private:
@@ -211,6 +231,764 @@ private:
 template <class _EXT, std::size_t _CH, uint32_t _MODE>
 EXTChannel::Callback EXTChannel_<_EXT, _CH, _MODE>::callback_impl;
 
+/*! \brief Cycle counter timestamp source
+ *
+ */
+struct EXTCycleClock {
+    using Type = rtcnt_t;
+
+    static inline Type
+    now()
+    {
+        return chSysGetRealtimeCounterX();
+    }
+};
+
+#if MAC_USE_PTP
+/*! \brief PTP timestamp source, in nanoseconds
+ *
+ */
+struct EXTPTPClock {
+    using Type = uint64_t;
+
+    static inline Type
+    now()
+    {
+        Type nanoseconds;
+
+        PTPTime::get(nanoseconds);
+
+        return nanoseconds;
+    }
+};
+#endif
+
+/*! \brief Timestamped edge
+ *
+ */
+template <typename _TIME>
+struct EXTEdge_ {
+    _TIME time; //!< Edge time
+    bool  rising; //!< Edge polarity
+};
+
+/*! \brief EXT channel with timestamped edge queue
+ *
+ * The ISR takes the timestamp as its first action, then the edge polarity,
+ * and pushes them into a lock free single producer, single consumer ring.
+ * A thread drains the ring in batches with read(), waiting with wait().
+ *
+ * With both edges enabled, the polarity is the pad level read right after
+ * the timestamp.
+ *
+ * \tparam _EXT EXTDriverTraits driver
+ * \tparam _CH channel
+ * \tparam _MODE channel mode (edges and GPIO port)
+ * \tparam _SIZE ring size, a power of 2
+ * \tparam _CLOCK timestamp source (e.g. EXTCycleClock, EXTPTPClock)
+ */
+template <class _EXT, std::size_t _CH, uint32_t _MODE, std::size_t _SIZE = 32, class _CLOCK = EXTCycleClock>
+class EXTTimestampChannel_
+{
+    static_assert(_CH < EXT_MAX_CHANNELS, "Channel does not exist");
+    static_assert((_SIZE & (_SIZE - 1)) == 0, "Ring size must be a power of 2");
+    static_assert((_MODE & EXT_CH_MODE_EDGES_MASK) != EXT_CH_MODE_DISABLED, "No edge selected");
+
+public:
+    using EXT   = _EXT;
+    using Clock = _CLOCK;
+    using Edge  = EXTEdge_<typename Clock::Type>;
+
+    static constexpr expchannel_t CHANNEL = _CH;
+
+public:
+    /*! \brief Start queueing edges
+     *
+     * Pending edges are discarded.
+     */
+    static void
+    start()
+    {
+        EXTChannelConfig tmp;
+
+        _head     = 0;
+        _tail     = 0;
+        _overruns = 0;
+        _running  = true;
+
+        tmp.mode = _MODE;
+        tmp.cb   = _callback;
+
+        extSetChannelMode(EXT::driver, _CH, &tmp);
+    }
+
+    static void
+    stop()
+    {
+        EXTChannelConfig tmp;
+
+        _running = false;
+
+        tmp.mode = _MODE;
+        tmp.cb   = nullptr;
+
+        extSetChannelMode(EXT::driver, _CH, &tmp);
+    }
+
+    /*! \brief Drain queued edges
+     *
+     * Must be called by a single consumer thread.
+     *
+     * \return number of edges read
+     */
+    static std::size_t
+    read(
+        Edge*       edges, //!< [out] edges, oldest first
+        std::size_t n //!< [in] maximum number of edges to read
+    )
+    {
+        uint32_t    tail  = _tail.load(std::memory_order_relaxed);
+        uint32_t    head  = _head.load(std::memory_order_acquire);
+        std::size_t count = 0;
+
+        while ((tail != head) && (count < n)) {
+            edges[count++] = _buffer[tail & (_SIZE - 1)];
+            tail++;
+        }
+
+        _tail.store(tail, std::memory_order_release);
+
+        return count;
+    }
+
+    /*! \brief Wait for queued edges
+     *
+     * \return true if edges are available
+     */
+    static bool
+    wait(
+        systime_t timeout = TIME_INFINITE
+    )
+    {
+        chSysLock();
+
+        if (_empty()) {
+            chThdSuspendTimeoutS(&_waiter, timeout);
+        }
+
+        bool available = !_empty();
+
+        chSysUnlock();
+
+        return available;
+    }
+
+    /*! \brief Number of edges dropped because the ring was full
+     *
+     */
+    static inline uint32_t
+    getOverruns()
+    {
+        return _overruns;
+    }
+
+    /*! \brief Serve the channel interrupt
+     *
+     * To be used by EXTDispatcher_. Nothing is done while stopped.
+     */
+    static inline void
+    serve()
+    {
+        if (_running) {
+            _callback(EXT::driver, _CH);
+        }
+    }
+
+private:
+    static constexpr uint32_t PORT  = (_MODE & EXT_MODE_GPIO_MASK) >> EXT_MODE_GPIO_OFF;
+    static constexpr uint32_t EDGES = _MODE & EXT_CH_MODE_EDGES_MASK;
+
+    static Edge                  _buffer[_SIZE];
+    static std::atomic<uint32_t> _head;
+    static std::atomic<uint32_t> _tail;
+    static uint32_t              _overruns;
+    static thread_reference_t    _waiter;
+    static volatile bool         _running;
+
+    static inline bool
+    _empty()
+    {
+        return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_relaxed);
+    }
+
+    static inline bool
+    _rising()
+    {
+        if (EDGES == EXT_CH_MODE_RISING_EDGE) {
+            return true;
+        } else if (EDGES == EXT_CH_MODE_FALLING_EDGE) {
+            return false;
+        } else {
+            return palReadPad(reinterpret_cast<stm32_gpio_t*>(GPIODriverTraits<PORT>::driver), _CH) == PAL_HIGH;
+        }
+    }
+
+    static void
+    _callback(
+        EXTDriver*   extp,
+        expchannel_t channel
+    )
+    {
+        (void)extp;
+        (void)channel;
+
+        typename Clock::Type time   = Clock::now();
+        bool                 rising = _rising();
+
+        uint32_t head = _head.load(std::memory_order_relaxed);
+
+        if ((head - _tail.load(std::memory_order_acquire)) < _SIZE) {
+            _buffer[head & (_SIZE - 1)].time   = time;
+            _buffer[head & (_SIZE - 1)].rising = rising;
+            _head.store(head + 1, std::memory_order_release);
+        } else {
+            _overruns++;
+        }
+
+        chSysLockFromISR();
+        chThdResumeI(&_waiter, MSG_OK);
+        chSysUnlockFromISR();
+    } // _callback
+};
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE, std::size_t _SIZE, class _CLOCK>
+typename EXTTimestampChannel_<_EXT, _CH, _MODE, _SIZE, _CLOCK>::Edge EXTTimestampChannel_<_EXT, _CH, _MODE, _SIZE, _CLOCK>::_buffer[_SIZE];
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE, std::size_t _SIZE, class _CLOCK>
+std::atomic<uint32_t> EXTTimestampChannel_<_EXT, _CH, _MODE, _SIZE, _CLOCK>::_head(0);
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE, std::size_t _SIZE, class _CLOCK>
+std::atomic<uint32_t> EXTTimestampChannel_<_EXT, _CH, _MODE, _SIZE, _CLOCK>::_tail(0);
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE, std::size_t _SIZE, class _CLOCK>
+uint32_t EXTTimestampChannel_<_EXT, _CH, _MODE, _SIZE, _CLOCK>::_overruns = 0;
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE, std::size_t _SIZE, class _CLOCK>
+thread_reference_t EXTTimestampChannel_<_EXT, _CH, _MODE, _SIZE, _CLOCK>::_waiter = nullptr;
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE, std::size_t _SIZE, class _CLOCK>
+volatile bool EXTTimestampChannel_<_EXT, _CH, _MODE, _SIZE, _CLOCK>::_running = false;
+
+/*! \brief EXT channel statistics
+ *
+ */
+struct EXTStormStatistics {
+    uint32_t edges; //!< Edges served by the ISR
+    uint32_t storms; //!< Number of times the line has been masked
+    uint32_t coalesced; //!< Edges delivered at re-arm, in a single callback per storm
+    bool     masked; //!< The line is currently masked
+};
+
+/*! \brief EXT channel with interrupt storm protection
+ *
+ * Edges are delivered to the callback one by one, with a count of 1. The
+ * edge number _MAX_EDGES + 1 within _WINDOW_US masks the line interrupt
+ * instead. During the _HOLDOFF_MS holdoff the pending flag, which still
+ * latches edges, is polled and cleared at each system tick; then the line
+ * is re-armed and a single callback is invoked with the edges coalesced
+ * during the storm: the one that tripped the protection, plus one for
+ * each tick in which further edges occurred. Edges closer than a tick
+ * are counted once.
+ *
+ * A line can therefore never take more than _MAX_EDGES + 1 interrupts
+ * every _WINDOW_US + _HOLDOFF_MS.
+ *
+ * \tparam _EXT EXTDriverTraits driver
+ * \tparam _CH channel
+ * \tparam _MODE channel mode
+ * \tparam _MAX_EDGES maximum number of edges within the window
+ * \tparam _WINDOW_US window length, in us
+ * \tparam _HOLDOFF_MS time the line stays masked, in ms
+ */
+template <class _EXT, std::size_t _CH, uint32_t _MODE, uint32_t _MAX_EDGES = 32, uint32_t _WINDOW_US = 1000, uint32_t _HOLDOFF_MS = 10>
+class EXTGuardedChannel_
+{
+    static_assert(_CH < EXT_MAX_CHANNELS, "Channel does not exist");
+    static_assert(_MAX_EDGES > 0, "At least one edge per window is required");
+    static_assert(_HOLDOFF_MS > 0, "Holdoff must be at least 1 ms");
+
+public:
+    using EXT = _EXT;
+
+    static constexpr expchannel_t CHANNEL = _CH;
+
+    /*! \brief Callback
+     *
+     * Invoked from ISR context with the channel and the number of edges:
+     * always 1, except at re-arm, where it is the number of edges coalesced
+     * during the storm.
+     */
+    using Callback = Delegate<void(uint32_t, uint32_t)>;
+
+public:
+    static void
+    setCallback(
+        Callback callback
+    )
+    {
+        EXTChannelConfig tmp;
+
+        _callback_impl = callback;
+
+        chSysLock();
+
+        if (!_initialized) {
+            chVTObjectInit(&_holdoff);
+            _initialized = true;
+        } else if (chVTIsArmedI(&_holdoff)) {
+            chVTResetI(&_holdoff);
+        }
+
+        _count = 0;
+        _statistics.masked = false;
+        chSysUnlock();
+
+        tmp.mode = _MODE;
+        tmp.cb   = _callback;
+
+        extSetChannelMode(EXT::driver, _CH, &tmp);
+    }
+
+    static void
+    resetCallback()
+    {
+        EXTChannelConfig tmp;
+
+        chSysLock();
+
+        if (_initialized && chVTIsArmedI(&_holdoff)) {
+            chVTResetI(&_holdoff);
+        }
+
+        _statistics.masked = false;
+        chSysUnlock();
+
+        tmp.mode = _MODE;
+        tmp.cb   = nullptr;
+
+        extSetChannelMode(EXT::driver, _CH, &tmp);
+
+        _callback_impl = nullptr;
+    }
+
+    static EXTStormStatistics
+    getStatistics()
+    {
+        chSysLock();
+        EXTStormStatistics tmp = _statistics;
+        chSysUnlock();
+
+        return tmp;
+    }
+
+    static void
+    resetStatistics()
+    {
+        chSysLock();
+        _statistics.edges     = 0;
+        _statistics.storms    = 0;
+        _statistics.coalesced = 0;
+        chSysUnlock();
+    }
+
+    /*! \brief Serve the channel interrupt
+     *
+     * To be used by EXTDispatcher_. Nothing is done without a callback.
+     */
+    static inline void
+    serve()
+    {
+        if (_callback_impl) {
+            _callback(EXT::driver, _CH);
+        }
+    }
+
+private:
+    static const uint32_t LINE = 1U << _CH;
+
+    static Callback           _callback_impl;
+    static EXTStormStatistics _statistics;
+    static virtual_timer_t    _holdoff;
+    static bool               _initialized;
+    static rtcnt_t            _window;
+    static uint32_t           _count;
+    static uint32_t           _coalesced;
+    static systime_t          _remaining;
+
+    static void
+    _callback(
+        EXTDriver*   extp,
+        expchannel_t channel
+    )
+    {
+        (void)extp;
+
+        rtcnt_t now = chSysGetRealtimeCounterX();
+
+        _statistics.edges++;
+
+        if ((_count == 0) || ((now - _window) > US2RTC(STM32_HCLK, _WINDOW_US))) {
+            _window = now;
+            _count  = 0;
+        }
+
+        if (++_count <= _MAX_EDGES) {
+            _callback_impl(channel, 1);
+            return;
+        }
+
+        // Storm: mask the interrupt only, so that the edges are still latched
+        chSysLockFromISR();
+        EXTI->IMR &= ~LINE;
+        _coalesced = 1;
+        _remaining = (MS2ST(_HOLDOFF_MS) > 0) ? MS2ST(_HOLDOFF_MS) : 1;
+        chVTSetI(&_holdoff, 1, _poll, nullptr);
+        _statistics.storms++;
+        _statistics.masked = true;
+        chSysUnlockFromISR();
+    } // _callback
+
+    static void
+    _poll(
+        void* p
+    )
+    {
+        (void)p;
+
+        chSysLockFromISR();
+
+        if ((EXTI->PR & LINE) != 0) {
+            EXTI->PR = LINE;
+            _coalesced++;
+        }
+
+        if (--_remaining > 0) {
+            chVTSetI(&_holdoff, 1, _poll, nullptr);
+            chSysUnlockFromISR();
+            return;
+        }
+
+        uint32_t count = _coalesced;
+
+        _count = 0;
+        _statistics.coalesced += count;
+        _statistics.masked     = false;
+        EXTI->IMR |= LINE;
+        chSysUnlockFromISR();
+
+        _callback_impl(_CH, count);
+    } // _poll
+};
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE, uint32_t _MAX_EDGES, uint32_t _WINDOW_US, uint32_t _HOLDOFF_MS>
+typename EXTGuardedChannel_<_EXT, _CH, _MODE, _MAX_EDGES, _WINDOW_US, _HOLDOFF_MS>::Callback EXTGuardedChannel_<_EXT, _CH, _MODE, _MAX_EDGES, _WINDOW_US, _HOLDOFF_MS>::_callback_impl;
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE, uint32_t _MAX_EDGES, uint32_t _WINDOW_US, uint32_t _HOLDOFF_MS>
+EXTStormStatistics EXTGuardedChannel_<_EXT, _CH, _MODE, _MAX_EDGES, _WINDOW_US, _HOLDOFF_MS>::_statistics;
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE, uint32_t _MAX_EDGES, uint32_t _WINDOW_US, uint32_t _HOLDOFF_MS>
+virtual_timer_t EXTGuardedChannel_<_EXT, _CH, _MODE, _MAX_EDGES, _WINDOW_US, _HOLDOFF_MS>::_holdoff;
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE, uint32_t _MAX_EDGES, uint32_t _WINDOW_US, uint32_t _HOLDOFF_MS>
+bool EXTGuardedChannel_<_EXT, _CH, _MODE, _MAX_EDGES, _WINDOW_US, _HOLDOFF_MS>::_initialized = false;
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE, uint32_t _MAX_EDGES, uint32_t _WINDOW_US, uint32_t _HOLDOFF_MS>
+rtcnt_t EXTGuardedChannel_<_EXT, _CH, _MODE, _MAX_EDGES, _WINDOW_US, _HOLDOFF_MS>::_window = 0;
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE, uint32_t _MAX_EDGES, uint32_t _WINDOW_US, uint32_t _HOLDOFF_MS>
+uint32_t EXTGuardedChannel_<_EXT, _CH, _MODE, _MAX_EDGES, _WINDOW_US, _HOLDOFF_MS>::_count = 0;
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE, uint32_t _MAX_EDGES, uint32_t _WINDOW_US, uint32_t _HOLDOFF_MS>
+uint32_t EXTGuardedChannel_<_EXT, _CH, _MODE, _MAX_EDGES, _WINDOW_US, _HOLDOFF_MS>::_coalesced = 0;
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE, uint32_t _MAX_EDGES, uint32_t _WINDOW_US, uint32_t _HOLDOFF_MS>
+systime_t EXTGuardedChannel_<_EXT, _CH, _MODE, _MAX_EDGES, _WINDOW_US, _HOLDOFF_MS>::_remaining = 0;
+
+/*! \brief EXT channel waking up threads
+ *
+ * The ISR directly signals a kernel object, and runs no user code: all the
+ * processing happens at thread priority. Each target has its own ISR, so
+ * no dispatch happens at interrupt time.
+ *
+ * \tparam _EXT EXTDriverTraits driver
+ * \tparam _CH channel
+ * \tparam _MODE channel mode
+ */
+template <class _EXT, std::size_t _CH, uint32_t _MODE>
+class EXTEventChannel_
+{
+    static_assert(_CH < EXT_MAX_CHANNELS, "Channel does not exist");
+
+public:
+    using EXT = _EXT;
+
+    static constexpr expchannel_t CHANNEL = _CH;
+
+    /*! \brief Flags broadcast on each edge
+     *
+     */
+    static constexpr eventflags_t FLAGS = static_cast<eventflags_t>(1) << _CH;
+
+public:
+    /*! \brief Broadcast FLAGS on an event source
+     *
+     */
+    static void
+    bind(
+        event_source_t& source
+    )
+    {
+        _source = &source;
+        _install(_broadcast);
+    }
+
+    /*! \brief Signal a binary semaphore
+     *
+     */
+    static void
+    bind(
+        binary_semaphore_t& semaphore
+    )
+    {
+        _semaphore = &semaphore;
+        _install(_signal);
+    }
+
+    /*! \brief Signal events to a thread
+     *
+     */
+    static void
+    bind(
+        thread_t*   thread,
+        eventmask_t events
+    )
+    {
+        _thread = thread;
+        _events = events;
+        _install(_notify);
+    }
+
+    static void
+    unbind()
+    {
+        _install(nullptr);
+    }
+
+    /*! \brief Serve the channel interrupt
+     *
+     * To be used by EXTDispatcher_.
+     */
+    static inline void
+    serve()
+    {
+        if (_isr != nullptr) {
+            _isr(EXT::driver, _CH);
+        }
+    }
+
+private:
+    static event_source_t*     _source;
+    static binary_semaphore_t* _semaphore;
+    static thread_t*           _thread;
+    static eventmask_t         _events;
+    static extcallback_t       _isr;
+
+    static inline void
+    _install(
+        extcallback_t callback
+    )
+    {
+        EXTChannelConfig tmp;
+
+        _isr = callback;
+
+        tmp.mode = _MODE;
+        tmp.cb   = callback;
+
+        extSetChannelMode(EXT::driver, _CH, &tmp);
+    }
+
+    static void
+    _broadcast(
+        EXTDriver*   extp,
+        expchannel_t channel
+    )
+    {
+        (void)extp;
+        (void)channel;
+
+        chSysLockFromISR();
+        chEvtBroadcastFlagsI(_source, FLAGS);
+        chSysUnlockFromISR();
+    }
+
+    static void
+    _signal(
+        EXTDriver*   extp,
+        expchannel_t channel
+    )
+    {
+        (void)extp;
+        (void)channel;
+
+        chSysLockFromISR();
+        chBSemSignalI(_semaphore);
+        chSysUnlockFromISR();
+    }
+
+    static void
+    _notify(
+        EXTDriver*   extp,
+        expchannel_t channel
+    )
+    {
+        (void)extp;
+        (void)channel;
+
+        chSysLockFromISR();
+        chEvtSignalI(_thread, _events);
+        chSysUnlockFromISR();
+    }
+};
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE>
+event_source_t * EXTEventChannel_<_EXT, _CH, _MODE>::_source = nullptr;
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE>
+binary_semaphore_t * EXTEventChannel_<_EXT, _CH, _MODE>::_semaphore = nullptr;
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE>
+thread_t * EXTEventChannel_<_EXT, _CH, _MODE>::_thread = nullptr;
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE>
+eventmask_t EXTEventChannel_<_EXT, _CH, _MODE>::_events = 0;
+
+template <class _EXT, std::size_t _CH, uint32_t _MODE>
+extcallback_t EXTEventChannel_<_EXT, _CH, _MODE>::_isr = nullptr;
+
+/*! \brief Dispatcher for the shared EXT interrupt vectors
+ *
+ * Serves the lines sharing the EXTI5-9 and EXTI10-15 vectors through a
+ * table built at compile time: the pending register is read once per
+ * interrupt, and each pending line is found with a count leading zeros and
+ * served with a direct call, regardless of the number of configured lines.
+ *
+ * Channels are the EXT channel classes (EXTChannel_, EXTEventChannel_,
+ * ...) to be served; they must still be configured as usual, to set up
+ * their edges and port. The HAL handlers must be disabled defining
+ * STM32_DISABLE_EXTI59_HANDLER and STM32_DISABLE_EXTI1510_HANDLER, and the
+ * vectors must be defined with CORE_HW_EXT_DISPATCHER_IRQ_HANDLERS().
+ *
+ * \tparam _CHANNELS channels served by the dispatcher
+ */
+template <class... _CHANNELS>
+class EXTDispatcher_
+{
+public:
+    static const uint32_t LINES_5_9   = 0x000003E0;
+    static const uint32_t LINES_10_15 = 0x0000FC00;
+
+    static inline void
+    serve(
+        uint32_t lines //!< [in] lines served by the vector
+    )
+    {
+        uint32_t pending = EXTI->PR & EXTI->IMR & lines;
+
+        EXTI->PR = pending;
+
+        while (pending != 0) {
+            uint32_t line = 31 - __builtin_clz(pending);
+
+            pending &= ~(1U << line);
+            _table[line]();
+        }
+    }
+
+    static void
+    serve5_9()
+    {
+        serve(LINES_5_9);
+    }
+
+    static void
+    serve10_15()
+    {
+        serve(LINES_10_15);
+    }
+
+private:
+    using Handler = void (*)();
+
+    template <class... _TAIL>
+    struct _Lookup {
+        static constexpr Handler
+        get(
+            std::size_t
+        )
+        {
+            return &_unused;
+        }
+    };
+
+    template <class _HEAD, class... _TAIL>
+    struct _Lookup<_HEAD, _TAIL...> {
+        static_assert(_HEAD::CHANNEL >= 5 && _HEAD::CHANNEL <= 15, "Channel is not served by a shared vector");
+
+        static constexpr Handler
+        get(
+            std::size_t line
+        )
+        {
+            return (line == _HEAD::CHANNEL) ? &_HEAD::serve : _Lookup<_TAIL...>::get(line);
+        }
+    };
+
+    static const Handler _table[16];
+
+    static void
+    _unused()
+    {}
+};
+
+template <class... _CHANNELS>
+const typename EXTDispatcher_<_CHANNELS...>::Handler EXTDispatcher_<_CHANNELS...>::_table[16] = {
+    _Lookup<_CHANNELS...>::get(0), _Lookup<_CHANNELS...>::get(1), _Lookup<_CHANNELS...>::get(2), _Lookup<_CHANNELS...>::get(3),
+    _Lookup<_CHANNELS...>::get(4), _Lookup<_CHANNELS...>::get(5), _Lookup<_CHANNELS...>::get(6), _Lookup<_CHANNELS...>::get(7),
+    _Lookup<_CHANNELS...>::get(8), _Lookup<_CHANNELS...>::get(9), _Lookup<_CHANNELS...>::get(10), _Lookup<_CHANNELS...>::get(11),
+    _Lookup<_CHANNELS...>::get(12), _Lookup<_CHANNELS...>::get(13), _Lookup<_CHANNELS...>::get(14), _Lookup<_CHANNELS...>::get(15)
+};
+
+/*! \brief Defines the shared EXT interrupt handlers
+ *
+ * To be used once, at global scope, in a source file.
+ *
+ * \param DISPATCHER fully qualified EXTDispatcher_ type
+ */
+#define CORE_HW_EXT_DISPATCHER_IRQ_HANDLERS(DISPATCHER) \
+    extern "C" { \
+    OSAL_IRQ_HANDLER(STM32_EXTI_LINE59_HANDLER) { \
+        OSAL_IRQ_PROLOGUE(); \
+        DISPATCHER::serve5_9(); \
+        OSAL_IRQ_EPILOGUE(); \
+    } \
+    OSAL_IRQ_HANDLER(STM32_EXTI_LINE1510_HANDLER) { \
+        OSAL_IRQ_PROLOGUE(); \
+        DISPATCHER::serve10_15(); \
+        OSAL_IRQ_EPILOGUE(); \
+    } \
+    }
+
 // --- Aliases -----------------------------------------------------------------
 
 using EXT_1 = EXTDriverTraits<1>;
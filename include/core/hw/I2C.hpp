@@ -11,13 +11,25 @@
 #include <core/hw/common.hpp>
 
 #include <core/hw/GPIO.hpp>
+#include <core/hw/RegisterMap.hpp>
+#include <core/hw/Delegate.hpp>
 
 #include <core/os/Time.hpp>
 
 #include "hal.h"
 
+#include <cstring>
+
 NAMESPACE_CORE_HW_BEGIN
 
+#ifndef CORE_HW_I2C_IDLE_TIMEOUT
+#define CORE_HW_I2C_IDLE_TIMEOUT 100
+#endif
+
+#ifndef CORE_HW_I2C_MAX_WRITE
+#define CORE_HW_I2C_MAX_WRITE 16
+#endif
+
 template <std::size_t S>
 struct I2CDriverTraits {};
 
@@ -63,6 +75,21 @@ public:
     virtual void
     releaseBus() = 0;
 
+    virtual void
+    recover() = 0;
+
+    /*! \brief Set the idle timeout
+     *
+     * The peripheral is kept running between bus acquisitions, and it is
+     * stopped once the bus has been idle for the given time, by the
+     * I2CMaster_::idle() thread. Time::INFINITE never stops it,
+     * Time::IMMEDIATE stops it on release.
+     */
+    virtual void
+    setIdleTimeout(
+        core::os::Time timeout
+    ) = 0;
+
     virtual bool
     exchange(
         Address        address,
@@ -104,17 +131,30 @@ class I2CMaster_:
 public:
     using I2C = _I2C;
 
+    /*! \brief Start the driver
+     *
+     * The peripheral is reconfigured only if it is stopped or if the
+     * configuration has changed.
+     */
     inline void
     start(
         const I2CConfig& config
     )
     {
+        _config = &config;
+
+        if ((I2C::driver->state == I2C_READY) && (I2C::driver->config != nullptr) && _same(*I2C::driver->config, config)) {
+            I2C::driver->config = &config;
+            return;
+        }
+
         ::i2cStart(I2C::driver, &config);
     }
 
     inline void
     stop()
     {
+        chVTReset(&_idle_timer);
         ::i2cStop(I2C::driver);
     }
 
@@ -122,16 +162,49 @@ public:
     acquireBus()
     {
         ::i2cAcquireBus(I2C::driver);
-        ::i2cStart(I2C::driver, I2C::driver->config);
+
+        chSysLock();
+        chVTResetI(&_idle_timer);
+        bool stopped = (I2C::driver->state == I2C_STOP);
+        chSysUnlock();
+
+        if (stopped) {
+            ::i2cStart(I2C::driver, (_config != nullptr) ? _config : I2C::driver->config);
+        }
     }
 
     inline void
     releaseBus()
     {
-        ::i2cStop(I2C::driver);
+        if (_idle_timeout == TIME_IMMEDIATE) {
+            ::i2cStop(I2C::driver);
+        } else if (_idle_timeout != TIME_INFINITE) {
+            chVTSet(&_idle_timer, _idle_timeout, _expired, nullptr);
+        }
+
         ::i2cReleaseBus(I2C::driver);
     }
 
+    /*! \brief Restart the peripheral after a timeout
+     *
+     * The driver is left locked after a timeout, and it must be restarted
+     * before the next transaction. The bus must be acquired.
+     */
+    inline void
+    recover()
+    {
+        ::i2cStop(I2C::driver);
+        ::i2cStart(I2C::driver, (_config != nullptr) ? _config : I2C::driver->config);
+    }
+
+    inline void
+    setIdleTimeout(
+        core::os::Time timeout
+    )
+    {
+        _idle_timeout = timeout.ticks();
+    }
+
     inline bool
     exchange(
         Address        address,
@@ -199,56 +272,252 @@ public:
     {
         return ::i2cGetErrors(I2C::driver);
     }
+
+    /*! \brief Idle timeout thread
+     *
+     * The driver cannot be stopped from the idle timer callback: this
+     * thread stops it once the timeout has expired, unless the bus has been
+     * used in the meantime. To be started with chThdCreateStatic(), one per
+     * I2C peripheral; without it, the peripheral is only stopped on release
+     * with Time::IMMEDIATE, or by stop().
+     */
+    static void
+    idle(
+        void* args
+    )
+    {
+        (void)args;
+
+        while (!chThdShouldTerminateX()) {
+            chSysLock();
+
+            if (!_idle_expired) {
+                osalThreadSuspendS(&_idle_thread);
+            }
+
+            _idle_expired = false;
+            chSysUnlock();
+
+            ::i2cAcquireBus(I2C::driver);
+
+            chSysLock();
+            bool expired = !chVTIsArmedI(&_idle_timer) && (I2C::driver->state == I2C_READY);
+            chSysUnlock();
+
+            if (expired) {
+                ::i2cStop(I2C::driver);
+            }
+
+            ::i2cReleaseBus(I2C::driver);
+        }
+    } // idle
+
+private:
+    static const I2CConfig*   _config;
+    static systime_t          _idle_timeout;
+    static virtual_timer_t    _idle_timer;
+    static thread_reference_t _idle_thread;
+    static bool               _idle_expired;
+
+    static inline bool
+    _same(
+        const I2CConfig& a,
+        const I2CConfig& b
+    )
+    {
+        // Not memcmp(), the padding is not initialized
+        return (a.timingr == b.timingr) && (a.cr1 == b.cr1) && (a.cr2 == b.cr2);
+    }
+
+    static void
+    _expired(
+        void* p
+    )
+    {
+        (void)p;
+
+        chSysLockFromISR();
+        _idle_expired = true;
+        osalThreadResumeI(&_idle_thread, MSG_OK);
+        chSysUnlockFromISR();
+    }
+};
+
+template <class _I2C>
+const I2CConfig * I2CMaster_<_I2C>::_config = nullptr;
+
+template <class _I2C>
+systime_t I2CMaster_<_I2C>::_idle_timeout = MS2ST(CORE_HW_I2C_IDLE_TIMEOUT);
+
+template <class _I2C>
+virtual_timer_t I2CMaster_<_I2C>::_idle_timer;
+
+template <class _I2C>
+thread_reference_t I2CMaster_<_I2C>::_idle_thread = nullptr;
+
+template <class _I2C>
+bool I2CMaster_<_I2C>::_idle_expired = false;
+
+/*! \brief Register transport over an I2C master
+ *
+ * To be used with RegisterMap_.
+ *
+ * \tparam _I2C I2CDriverTraits driver
+ * \tparam _ADDRESS 7 bit slave address
+ * \tparam _INCREMENT bits set in the register address for multi byte transfers
+ *
+ * At most CORE_HW_I2C_MAX_WRITE bytes can be written at once.
+ */
+template <class _I2C, uint8_t _ADDRESS, uint8_t _INCREMENT = 0x00>
+class I2CRegisterTransport_
+{
+public:
+    using Master = I2CMaster_<_I2C>;
+
+    static inline bool
+    read(
+        uint8_t     address,
+        void*       data,
+        std::size_t n
+    )
+    {
+        Master  master;
+        uint8_t command = address | ((n > 1) ? _INCREMENT : 0x00);
+
+        master.acquireBus();
+        bool success = master.exchange(_ADDRESS, 1, &command, n, data);
+        master.releaseBus();
+
+        return success;
+    }
+
+    static inline bool
+    write(
+        uint8_t     address,
+        const void* data,
+        std::size_t n
+    )
+    {
+        CORE_ASSERT(n <= CORE_HW_I2C_MAX_WRITE);
+
+        Master  master;
+        uint8_t buffer[CORE_HW_I2C_MAX_WRITE + 1];
+
+        buffer[0] = address | ((n > 1) ? _INCREMENT : 0x00);
+        std::memcpy(&buffer[1], data, n);
+
+        master.acquireBus();
+        bool success = master.send(_ADDRESS, n + 1, buffer);
+        master.releaseBus();
+
+        return success;
+    }
 };
 
-#if 0 // NE VALE LA PENA???
+/*! \brief I2C device
+ *
+ */
 class I2CDevice
 {
 public:
+    using Address = I2CMaster::Address;
+
     virtual void
     acquireBus() = 0;
 
     virtual void
     releaseBus() = 0;
 
-    virtual void
+    virtual bool
     exchange(
-        size_t      n,
-        const void* txbuf,
-        void*       rxbuf
+        size_t         n_tx,
+        const void*    txbuf,
+        size_t         n_rx,
+        void*          rxbuf,
+        core::os::Time timeout = core::os::Time::INFINITE,
+        msg_t*         msg = nullptr
     ) = 0;
 
-    virtual void
+    virtual bool
     send(
-        size_t      n,
-        const void* txbuf
+        size_t         n_tx,
+        const void*    txbuf,
+        core::os::Time timeout = core::os::Time::INFINITE,
+        msg_t*         msg = nullptr
     ) = 0;
 
-    virtual void
+    virtual bool
     receive(
-        size_t n,
-        void*  rxbuf
+        size_t         n_rx,
+        void*          rxbuf,
+        core::os::Time timeout = core::os::Time::INFINITE,
+        msg_t*         msg = nullptr
+    ) = 0;
+
+    /*! \brief Read consecutive registers
+     *
+     * Acquires the bus. The register cache is bypassed.
+     */
+    virtual bool
+    readRegisters(
+        uint8_t address, //!< [in] first register
+        void*   data, //!< [out] register values
+        size_t  n //!< [in] number of bytes
     ) = 0;
+
+    /*! \brief Write consecutive registers
+     *
+     * Acquires the bus. At most CORE_HW_I2C_MAX_WRITE bytes can be written
+     * at once. Only the cached values are updated: bytes of registers that
+     * are not cacheable stay out of the cache.
+     */
+    virtual bool
+    writeRegisters(
+        uint8_t     address, //!< [in] first register
+        const void* data, //!< [in] register values
+        size_t      n //!< [in] number of bytes
+    ) = 0;
+
+    /*! \brief Invalidate the register cache
+     *
+     * To be called when the device could have changed its configuration
+     * (e.g. after a device reset).
+     */
+    virtual void
+    invalidateCache() = 0;
 };
 
-template <class _I2C, uint8_t _ADDRESS>
+/*! \brief I2C device with a write-through register cache
+ *
+ * Registers in [0, _CACHE_SIZE) that are neither read only nor flagged as
+ * volatile are shadowed: reads are served from the cache once the value is known, and
+ * writes reach the bus only if the value changes.
+ *
+ * \tparam _I2C I2CDriverTraits driver
+ * \tparam _ADDRESS 7 bit slave address
+ * \tparam _CACHE_SIZE number of cached register addresses (0 to disable the cache)
+ * \tparam _INCREMENT bits set in the register address for multi byte transfers
+ */
+template <class _I2C, uint8_t _ADDRESS, std::size_t _CACHE_SIZE = 0, uint8_t _INCREMENT = 0x00>
 class I2CDevice_:
     public I2CDevice
 {
+    static_assert(_CACHE_SIZE <= 256, "Cache cannot exceed the register address space");
+
 public:
     using I2C = _I2C;
-    static const I2CMaster<I2C>::Address ADDRESS = _ADDRESS;
+    static const Address ADDRESS = _ADDRESS;
 
     inline void
     acquireBus()
     {
-        ::i2cAcquireBus(I2C::driver);
+        _master.acquireBus();
     }
 
     inline void
     releaseBus()
     {
-        ::i2cReleaseBus(I2C::driver);
+        _master.releaseBus();
     }
 
     inline bool
@@ -261,15 +530,7 @@ public:
         msg_t*         msg = nullptr
     )
     {
-        address &= 0x7F;
-
-        msg_t status = ::i2cMasterTransmitTimeout(I2C::driver, ADDRESS, txbuf, n_tx, rxbuf, n_rx, timeout.ticks());
-
-        if (msg != nullptr) {
-            *msg = status;
-        }
-
-        return status == MSG_OK;
+        return _master.exchange(ADDRESS, n_tx, txbuf, n_rx, rxbuf, timeout, msg);
     }
 
     inline bool
@@ -280,40 +541,256 @@ public:
         msg_t*         msg = nullptr
     )
     {
-        address &= 0x7F;
-
-        msg_t status = ::i2cMasterTransmitTimeout(I2C::driver, ADDRESS, txbuf, n_tx, nullptr, 0, timeout.ticks());
-
-        if (msg != nullptr) {
-            *msg = status;
-        }
-
-        return status == MSG_OK;
+        return _master.send(ADDRESS, n_tx, txbuf, timeout, msg);
     }
 
     inline bool
     receive(
         size_t         n_rx,
-        const void*    rxbuf,
+        void*          rxbuf,
         core::os::Time timeout = core::os::Time::INFINITE,
         msg_t*         msg = nullptr
     )
     {
-        address &= 0x7F;
+        return _master.receive(ADDRESS, n_rx, rxbuf, timeout, msg);
+    }
 
-        msg_t status = ::i2cMasterReceiveTimeout(I2C::driver, ADDRESS, rxbuf, n_rx, timeout.ticks());
+    inline bool
+    readRegisters(
+        uint8_t address,
+        void*   data,
+        size_t  n
+    )
+    {
+        uint8_t command = address | ((n > 1) ? _INCREMENT : 0x00);
 
-        if (msg != nullptr) {
-            *msg = status;
+        _master.acquireBus();
+        bool success = _master.exchange(ADDRESS, 1, &command, n, data);
+        _master.releaseBus();
+
+        return success;
+    }
+
+    inline bool
+    writeRegisters(
+        uint8_t     address,
+        const void* data,
+        size_t      n
+    )
+    {
+        CORE_ASSERT(n <= CORE_HW_I2C_MAX_WRITE);
+
+        uint8_t buffer[CORE_HW_I2C_MAX_WRITE + 1];
+
+        buffer[0] = address | ((n > 1) ? _INCREMENT : 0x00);
+        std::memcpy(&buffer[1], data, n);
+
+        _master.acquireBus();
+        bool success = _master.send(ADDRESS, n + 1, buffer);
+
+        if (success) {
+            // The register types are not known here
+            _update(address, &buffer[1], n);
+        } else {
+            _invalidate(address, n);
         }
 
-        return status == MSG_OK;
+        _master.releaseBus();
+
+        return success;
+    } // writeRegisters
+
+    inline void
+    invalidateCache()
+    {
+        chSysLock();
+        std::memset(_valid, 0, sizeof(_valid));
+        chSysUnlock();
+    }
+
+    /*! \brief Read a register
+     *
+     * Cached registers are read from the bus only the first time.
+     */
+    template <class _REGISTER>
+    inline bool
+    read(
+        typename _REGISTER::Type& value //!< [out] register value
+    )
+    {
+        static_assert(_REGISTER::ACCESS != RegisterAccess::WRITE_ONLY, "Register is write only");
+
+        uint8_t raw[_REGISTER::SIZE];
+
+        if (!_cached<_REGISTER>() || !_load(_REGISTER::ADDRESS, raw, _REGISTER::SIZE)) {
+            if (!readRegisters(_REGISTER::ADDRESS, raw, _REGISTER::SIZE)) {
+                return false;
+            }
+
+            if (_cached<_REGISTER>()) {
+                _store(_REGISTER::ADDRESS, raw, _REGISTER::SIZE);
+            }
+        }
+
+        value = _REGISTER::decode(raw);
+
+        return true;
+    }
+
+    /*! \brief Write a register
+     *
+     * Cached registers are written to the bus only if their value changes.
+     */
+    template <class _REGISTER>
+    inline bool
+    write(
+        typename _REGISTER::Type value //!< [in] register value
+    )
+    {
+        static_assert(_REGISTER::ACCESS != RegisterAccess::READ_ONLY, "Register is read only");
+
+        uint8_t raw[_REGISTER::SIZE];
+        uint8_t cached[_REGISTER::SIZE];
+
+        _REGISTER::encode(value, raw);
+
+        if (_cached<_REGISTER>() && _load(_REGISTER::ADDRESS, cached, _REGISTER::SIZE) && (std::memcmp(raw, cached, _REGISTER::SIZE) == 0)) {
+            return true;
+        }
+
+        if (!writeRegisters(_REGISTER::ADDRESS, raw, _REGISTER::SIZE)) {
+            return false;
+        }
+
+        if (_cached<_REGISTER>()) {
+            _store(_REGISTER::ADDRESS, raw, _REGISTER::SIZE);
+        }
+
+        return true;
+    } // write
+
+    /*! \brief Read-modify-write a register
+     *
+     * With a cached register this costs at most one bus transaction.
+     */
+    template <class _REGISTER>
+    inline bool
+    modify(
+        typename _REGISTER::Type clear, //!< [in] bits to clear
+        typename _REGISTER::Type set //!< [in] bits to set
+    )
+    {
+        typename _REGISTER::Type value;
+
+        if (!read<_REGISTER>(value)) {
+            return false;
+        }
+
+        return write<_REGISTER>((value & ~clear) | set);
     }
 
 private:
-    CS _cs;
+    static I2CMaster_<I2C> _master;
+    static uint8_t  _cache[_CACHE_SIZE > 0 ? _CACHE_SIZE : 1];
+    static uint32_t _valid[(_CACHE_SIZE + 31) / 32 + 1];
+
+    template <class _REGISTER>
+    static constexpr bool
+    _cached()
+    {
+        // Read only registers are owned by the device (status, data, FIFOs)
+        return !_REGISTER::VOLATILE && (_REGISTER::ACCESS != RegisterAccess::READ_ONLY) && ((_REGISTER::ADDRESS + _REGISTER::SIZE) <= _CACHE_SIZE);
+    }
+
+    static inline bool
+    _load(
+        uint8_t  address,
+        uint8_t* data,
+        size_t   n
+    )
+    {
+        bool valid = true;
+
+        chSysLock();
+
+        for (size_t i = address; i < address + n; i++) {
+            valid = valid && ((_valid[i / 32] & (1u << (i % 32))) != 0);
+        }
+
+        if (valid) {
+            std::memcpy(data, &_cache[address], n);
+        }
+
+        chSysUnlock();
+
+        return valid;
+    }
+
+    static inline void
+    _store(
+        uint8_t        address,
+        const uint8_t* data,
+        size_t         n
+    )
+    {
+        chSysLock();
+
+        for (size_t i = address; (i < address + n) && (i < _CACHE_SIZE); i++) {
+            _cache[i]       = data[i - address];
+            _valid[i / 32] |= (1u << (i % 32));
+        }
+
+        chSysUnlock();
+    }
+
+    /*! \brief Update the bytes already in the cache
+     *
+     * Only registers known to be cacheable are ever stored, by read() and
+     * write().
+     */
+    static inline void
+    _update(
+        uint8_t        address,
+        const uint8_t* data,
+        size_t         n
+    )
+    {
+        chSysLock();
+
+        for (size_t i = address; (i < address + n) && (i < _CACHE_SIZE); i++) {
+            if (_valid[i / 32] & (1u << (i % 32))) {
+                _cache[i] = data[i - address];
+            }
+        }
+
+        chSysUnlock();
+    }
+
+    static inline void
+    _invalidate(
+        uint8_t address,
+        size_t  n
+    )
+    {
+        chSysLock();
+
+        for (size_t i = address; (i < address + n) && (i < _CACHE_SIZE); i++) {
+            _valid[i / 32] &= ~(1u << (i % 32));
+        }
+
+        chSysUnlock();
+    }
 };
-#endif // if 0
+
+template <class _I2C, uint8_t _ADDRESS, std::size_t _CACHE_SIZE, uint8_t _INCREMENT>
+I2CMaster_<_I2C> I2CDevice_<_I2C, _ADDRESS, _CACHE_SIZE, _INCREMENT>::_master;
+
+template <class _I2C, uint8_t _ADDRESS, std::size_t _CACHE_SIZE, uint8_t _INCREMENT>
+uint8_t I2CDevice_<_I2C, _ADDRESS, _CACHE_SIZE, _INCREMENT>::_cache[_CACHE_SIZE > 0 ? _CACHE_SIZE : 1];
+
+template <class _I2C, uint8_t _ADDRESS, std::size_t _CACHE_SIZE, uint8_t _INCREMENT>
+uint32_t I2CDevice_<_I2C, _ADDRESS, _CACHE_SIZE, _INCREMENT>::_valid[(_CACHE_SIZE + 31) / 32 + 1];
+
 // --- Aliases -----------------------------------------------------------------
 
 using I2C_1 = I2CDriverTraits<1>;
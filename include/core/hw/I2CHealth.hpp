@@ -0,0 +1,370 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/hw/namespace.hpp>
+#include <core/hw/common.hpp>
+
+#include <core/hw/GPIO.hpp>
+#include <core/hw/I2C.hpp>
+
+#include <cstring>
+
+#include "hal.h"
+
+NAMESPACE_CORE_HW_BEGIN
+
+#ifndef CORE_HW_I2C_HEALTH_BINS
+#define CORE_HW_I2C_HEALTH_BINS 16
+#endif
+
+#ifndef CORE_HW_I2C_RECOVERY_HALF_PERIOD
+#define CORE_HW_I2C_RECOVERY_HALF_PERIOD 5
+#endif
+
+#ifndef CORE_HW_I2C_RECOVERY_MAX_STRETCH
+#define CORE_HW_I2C_RECOVERY_MAX_STRETCH 100
+#endif
+
+/*! \brief Per device I2C health statistics
+ *
+ */
+struct I2CHealthStatistics {
+    static const std::size_t BINS   = CORE_HW_I2C_HEALTH_BINS;
+    static const std::size_t ERRORS = 7; //!< One counter per I2C_xxx error flag bit
+
+    I2CMaster::Address address; //!< Slave address
+    uint32_t           transactions; //!< Number of transactions
+    uint32_t           failures; //!< Number of failed transactions
+    uint32_t           timeouts; //!< Number of timed out transactions
+    uint32_t           errors[ERRORS]; //!< Error flag counters, errors[i] counts flag (1 << i)
+    uint32_t           latency[BINS]; //!< Latency histogram, bin i counts [2^i, 2^(i+1)) us, the last bin is open ended
+    uint32_t           max_latency; //!< Longest transaction, in us
+};
+
+/*! \brief I2C bus health monitor
+ *
+ * Wraps the transactions of an I2C master, keeping per device latency
+ * histograms and error counters, and recovers the bus when it gets stuck.
+ *
+ * A bus is stuck when SDA is held low outside a transaction, or when a
+ * transaction times out (which also locks the driver). Recovery switches
+ * the pads to GPIO, clocks SCL until the slave releases SDA (at most 9
+ * clocks), generates a STOP condition, then gives the pads back to the
+ * peripheral and restarts the driver with I2CMaster_::recover(). Clock stretching
+ * during recovery is bounded too, so the worst case recovery time is
+ * about 9 * (2 * CORE_HW_I2C_RECOVERY_HALF_PERIOD + CORE_HW_I2C_RECOVERY_MAX_STRETCH) us.
+ *
+ * \tparam _I2C I2CDriverTraits driver
+ * The pads are only reconfigured during recovery, so they should keep
+ * Pad::Mode::RESET as default mode.
+ *
+ * \tparam _SCL Pad_ SCL pad, with the I2C function as alternate mode
+ * \tparam _SDA Pad_ SDA pad, with the I2C function as alternate mode
+ * \tparam _MAX_DEVICES maximum number of monitored slave addresses
+ */
+template <class _I2C, class _SCL, class _SDA, std::size_t _MAX_DEVICES = 8>
+class I2CHealth_
+{
+public:
+    using I2C    = _I2C;
+    using Master = I2CMaster_<_I2C>;
+
+    inline void
+    acquireBus()
+    {
+        _master.acquireBus();
+    }
+
+    inline void
+    releaseBus()
+    {
+        _master.releaseBus();
+    }
+
+    /*! \brief Monitored exchange
+     *
+     * The bus must be acquired. A stuck bus is recovered before the
+     * transaction, and after a failed one.
+     */
+    bool
+    exchange(
+        I2CMaster::Address address,
+        size_t             n_tx,
+        const void*        txbuf,
+        size_t             n_rx,
+        void*              rxbuf,
+        core::os::Time     timeout = core::os::Time::INFINITE,
+        msg_t*             msg = nullptr
+    )
+    {
+        if (isStuck()) {
+            recover();
+        }
+
+        msg_t   status;
+        rtcnt_t start   = chSysGetRealtimeCounterX();
+        bool    success = _master.exchange(address, n_tx, txbuf, n_rx, rxbuf, timeout, &status);
+        rtcnt_t cycles  = chSysGetRealtimeCounterX() - start;
+
+        I2CMaster::Flags errors = success ? 0 : _master.getErrors();
+
+        _record(address, cycles, status, errors);
+
+        if ((status == MSG_TIMEOUT) || ((status != MSG_OK) && isStuck())) {
+            recover();
+        }
+
+        if (msg != nullptr) {
+            *msg = status;
+        }
+
+        return success;
+    } // exchange
+
+    inline bool
+    send(
+        I2CMaster::Address address,
+        size_t             n_tx,
+        const void*        txbuf,
+        core::os::Time     timeout = core::os::Time::INFINITE,
+        msg_t*             msg = nullptr
+    )
+    {
+        return exchange(address, n_tx, txbuf, 0, nullptr, timeout, msg);
+    }
+
+    /*! \brief Check the bus lines
+     *
+     * \return true if SDA or SCL is held low while no transaction is running
+     */
+    static inline bool
+    isStuck()
+    {
+        // The input data register is readable in alternate mode too
+        return !_sda.read() || !_scl.read();
+    }
+
+    /*! \brief Recover the bus
+     *
+     * The bus must be acquired.
+     *
+     * \return true if the bus lines are released
+     */
+    static bool
+    recover()
+    {
+        _scl.set();
+        _sda.set();
+        _scl.setMode(Pad::Mode::OUTPUT_OPENDRAIN);
+        _sda.setMode(Pad::Mode::OUTPUT_OPENDRAIN);
+
+        // Clock out the byte the slave is transmitting
+        for (std::size_t i = 0; (i < 9) && !_sda.read(); i++) {
+            _scl.clear();
+            _delay(CORE_HW_I2C_RECOVERY_HALF_PERIOD);
+            _scl.set();
+            _delay(CORE_HW_I2C_RECOVERY_HALF_PERIOD);
+            _stretch();
+        }
+
+        // STOP condition
+        _sda.clear();
+        _delay(CORE_HW_I2C_RECOVERY_HALF_PERIOD);
+        _scl.set();
+        _stretch();
+        _delay(CORE_HW_I2C_RECOVERY_HALF_PERIOD);
+        _sda.set();
+        _delay(CORE_HW_I2C_RECOVERY_HALF_PERIOD);
+
+        bool released = _scl.read() && _sda.read();
+
+        _scl.setAlternateMode();
+        _sda.setAlternateMode();
+
+        _master.recover();
+
+        chSysLock();
+        _recoveries++;
+
+        if (!released) {
+            _failed_recoveries++;
+        }
+
+        chSysUnlock();
+
+        return released;
+    } // recover
+
+    /*! \brief Get a snapshot of the statistics of a device
+     *
+     * \return false if the address has never been used
+     */
+    static bool
+    getStatistics(
+        I2CMaster::Address   address,
+        I2CHealthStatistics& statistics
+    )
+    {
+        bool found = false;
+
+        chSysLock();
+
+        I2CHealthStatistics* device = _find(address);
+
+        if (device != nullptr) {
+            statistics = *device;
+            found      = true;
+        }
+
+        chSysUnlock();
+
+        return found;
+    }
+
+    /*! \brief Number of recoveries performed
+     *
+     */
+    static inline uint32_t
+    getRecoveries()
+    {
+        return _recoveries;
+    }
+
+    /*! \brief Number of recoveries that did not release the bus
+     *
+     */
+    static inline uint32_t
+    getFailedRecoveries()
+    {
+        return _failed_recoveries;
+    }
+
+    static void
+    resetStatistics()
+    {
+        chSysLock();
+        _count             = 0;
+        _recoveries        = 0;
+        _failed_recoveries = 0;
+        chSysUnlock();
+    }
+
+private:
+    static Master              _master;
+    static _SCL                _scl;
+    static _SDA                _sda;
+    static I2CHealthStatistics _devices[_MAX_DEVICES];
+    static std::size_t         _count;
+    static uint32_t            _recoveries;
+    static uint32_t            _failed_recoveries;
+
+    static inline void
+    _delay(
+        uint32_t us
+    )
+    {
+        chSysPolledDelayX(US2RTC(STM32_HCLK, us));
+    }
+
+    static inline void
+    _stretch()
+    {
+        // Wait for the slave to release SCL, but not forever
+        for (std::size_t i = 0; (i < CORE_HW_I2C_RECOVERY_MAX_STRETCH) && !_scl.read(); i++) {
+            _delay(1);
+        }
+    }
+
+    static I2CHealthStatistics*
+    _find(
+        I2CMaster::Address address
+    )
+    {
+        for (std::size_t i = 0; i < _count; i++) {
+            if (_devices[i].address == address) {
+                return &_devices[i];
+            }
+        }
+
+        return nullptr;
+    }
+
+    static void
+    _record(
+        I2CMaster::Address address,
+        rtcnt_t            cycles,
+        msg_t              status,
+        I2CMaster::Flags   errors
+    )
+    {
+        uint32_t    us  = cycles / (STM32_HCLK / 1000000);
+        std::size_t bin = 0;
+
+        while ((bin < I2CHealthStatistics::BINS - 1) && ((us >> (bin + 1)) != 0)) {
+            bin++;
+        }
+
+        chSysLock();
+
+        I2CHealthStatistics* device = _find(address);
+
+        if ((device == nullptr) && (_count < _MAX_DEVICES)) {
+            device = &_devices[_count++];
+            std::memset(device, 0, sizeof(I2CHealthStatistics));
+            device->address = address;
+        }
+
+        if (device != nullptr) {
+            device->transactions++;
+            device->latency[bin]++;
+
+            if (us > device->max_latency) {
+                device->max_latency = us;
+            }
+
+            if (status != MSG_OK) {
+                device->failures++;
+            }
+
+            if (status == MSG_TIMEOUT) {
+                device->timeouts++;
+            }
+
+            for (std::size_t i = 0; i < I2CHealthStatistics::ERRORS; i++) {
+                if (errors & (1 << i)) {
+                    device->errors[i]++;
+                }
+            }
+        }
+
+        chSysUnlock();
+    } // _record
+};
+
+template <class _I2C, class _SCL, class _SDA, std::size_t _MAX_DEVICES>
+typename I2CHealth_<_I2C, _SCL, _SDA, _MAX_DEVICES>::Master I2CHealth_<_I2C, _SCL, _SDA, _MAX_DEVICES>::_master;
+
+template <class _I2C, class _SCL, class _SDA, std::size_t _MAX_DEVICES>
+_SCL I2CHealth_<_I2C, _SCL, _SDA, _MAX_DEVICES>::_scl;
+
+template <class _I2C, class _SCL, class _SDA, std::size_t _MAX_DEVICES>
+_SDA I2CHealth_<_I2C, _SCL, _SDA, _MAX_DEVICES>::_sda;
+
+template <class _I2C, class _SCL, class _SDA, std::size_t _MAX_DEVICES>
+I2CHealthStatistics I2CHealth_<_I2C, _SCL, _SDA, _MAX_DEVICES>::_devices[_MAX_DEVICES];
+
+template <class _I2C, class _SCL, class _SDA, std::size_t _MAX_DEVICES>
+std::size_t I2CHealth_<_I2C, _SCL, _SDA, _MAX_DEVICES>::_count = 0;
+
+template <class _I2C, class _SCL, class _SDA, std::size_t _MAX_DEVICES>
+uint32_t I2CHealth_<_I2C, _SCL, _SDA, _MAX_DEVICES>::_recoveries = 0;
+
+template <class _I2C, class _SCL, class _SDA, std::size_t _MAX_DEVICES>
+uint32_t I2CHealth_<_I2C, _SCL, _SDA, _MAX_DEVICES>::_failed_recoveries = 0;
+
+NAMESPACE_CORE_HW_END
@@ -0,0 +1,255 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/hw/namespace.hpp>
+#include <core/hw/common.hpp>
+
+#include <core/hw/I2C.hpp>
+#include <core/hw/Delegate.hpp>
+
+#include "hal.h"
+
+NAMESPACE_CORE_HW_BEGIN
+
+/*! \brief Asynchronous I2C transaction
+ *
+ * The job is owned by the caller and must stay alive until completed.
+ */
+struct I2CJob {
+    /*! \brief Completion callback
+     *
+     * Invoked from the queue thread once result is set, just before the job
+     * is completed: the job must not be submitted again from the callback.
+     */
+    using Callback = Delegate<void(I2CJob&)>;
+
+    /*! \brief Event flags broadcast on completion
+     *
+     */
+    enum : eventflags_t {
+        COMPLETED = 0x01, //!< Transaction succeeded
+        FAILED    = 0x02 //!< Transaction failed
+    };
+
+    I2CMaster::Address address; //!< Slave address
+    size_t          n_tx; //!< Number of bytes to transmit
+    const void*     txbuf; //!< Transmit buffer
+    size_t          n_rx; //!< Number of bytes to receive
+    void*           rxbuf; //!< Receive buffer
+    systime_t       timeout; //!< Transaction timeout, in system ticks
+    uint8_t         priority; //!< Priority (higher first)
+    Callback        callback; //!< Completion callback (optional)
+    event_source_t* event; //!< Event source broadcast on completion (optional)
+
+    volatile msg_t     result; //!< Transaction result, valid when done
+    volatile bool      done; //!< Completion flag, maintained by the queue
+    thread_reference_t waiter; //!< Thread waiting for completion, maintained by the queue
+};
+
+/*! \brief Asynchronous I2C job queue
+ *
+ * Jobs are submitted without blocking and executed in priority order by
+ * one thread per bus, which sleeps in the driver while each transfer is
+ * carried out by the peripheral interrupts. Queued jobs are executed back
+ * to back within one bus acquisition.
+ *
+ * The queue thread must be created by the application, using worker() as
+ * thread function.
+ *
+ * \tparam _I2C I2CDriverTraits driver
+ * \tparam _SIZE maximum number of pending jobs
+ */
+template <class _I2C, std::size_t _SIZE = 8>
+class I2CQueue_
+{
+public:
+    using I2C = _I2C;
+
+    /*! \brief Submit a job
+     *
+     * \return false if the queue is full
+     */
+    static bool
+    submit(
+        I2CJob& job
+    )
+    {
+        chSysLock();
+        bool success = submitS(job);
+        chSysUnlock();
+
+        return success;
+    }
+
+    /*! \brief Submit a job
+     *
+     * To be called from a locked state.
+     *
+     * \return false if the queue is full
+     */
+    static bool
+    submitS(
+        I2CJob& job
+    )
+    {
+        if (_count == _SIZE) {
+            return false;
+        }
+
+        job.done   = false;
+        job.result = MSG_RESET;
+        job.waiter = nullptr;
+
+        // Insert after the jobs with the same or higher priority
+        std::size_t i = _count;
+
+        while ((i > 0) && (_jobs[i - 1]->priority < job.priority)) {
+            _jobs[i] = _jobs[i - 1];
+            i--;
+        }
+
+        _jobs[i] = &job;
+        _count++;
+
+        if (_thread != nullptr) {
+            chEvtSignalI(_thread, EVENT_MASK(0));
+        }
+
+        return true;
+    } // submitS
+
+    /*! \brief Wait for a job to complete
+     *
+     * \return the transaction result
+     */
+    static msg_t
+    wait(
+        I2CJob& job
+    )
+    {
+        chSysLock();
+
+        msg_t msg = job.result;
+
+        if (!job.done) {
+            msg = osalThreadSuspendS(&job.waiter);
+        }
+
+        chSysUnlock();
+
+        return msg;
+    }
+
+    /*! \brief Queue thread function
+     *
+     */
+    static void
+    worker(
+        void* args
+    )
+    {
+        (void)args;
+
+        I2CMaster_<I2C> master;
+
+        _thread = chThdGetSelfX();
+
+        while (!chThdShouldTerminateX()) {
+            I2CJob* job = _pop();
+
+            if (job == nullptr) {
+                chEvtWaitAny(EVENT_MASK(0));
+                continue;
+            }
+
+            master.acquireBus();
+
+            while (job != nullptr) {
+                _run(master, *job);
+                job = _pop();
+            }
+
+            master.releaseBus();
+        }
+
+        _thread = nullptr;
+    } // worker
+
+private:
+    static I2CJob*     _jobs[_SIZE];
+    static std::size_t _count;
+    static thread_t*   _thread;
+
+    static I2CJob*
+    _pop()
+    {
+        I2CJob* job = nullptr;
+
+        chSysLock();
+
+        if (_count > 0) {
+            job = _jobs[0];
+            _count--;
+
+            for (std::size_t i = 0; i < _count; i++) {
+                _jobs[i] = _jobs[i + 1];
+            }
+        }
+
+        chSysUnlock();
+
+        return job;
+    }
+
+    static void
+    _run(
+        I2CMaster_<I2C>& master,
+        I2CJob&          job
+    )
+    {
+        msg_t msg;
+
+        if (job.n_tx > 0) {
+            msg = ::i2cMasterTransmitTimeout(I2C::driver, job.address & 0x7F, reinterpret_cast<const uint8_t*>(job.txbuf), job.n_tx, reinterpret_cast<uint8_t*>(job.rxbuf), job.n_rx, job.timeout);
+        } else {
+            msg = ::i2cMasterReceiveTimeout(I2C::driver, job.address & 0x7F, reinterpret_cast<uint8_t*>(job.rxbuf), job.n_rx, job.timeout);
+        }
+
+        if (msg == MSG_TIMEOUT) {
+            master.recover();
+        }
+
+        job.result = msg;
+
+        if (job.callback) {
+            job.callback(job);
+        }
+
+        // The job belongs to the submitter again from here on: do not touch it afterwards
+        chSysLock();
+        job.done = true;
+
+        if (job.event != nullptr) {
+            chEvtBroadcastFlagsI(job.event, (msg == MSG_OK) ? I2CJob::COMPLETED : I2CJob::FAILED);
+        }
+
+        osalThreadResumeS(&job.waiter, msg);
+        chSysUnlock();
+    } // _run
+};
+
+template <class _I2C, std::size_t _SIZE>
+I2CJob * I2CQueue_<_I2C, _SIZE>::_jobs[_SIZE];
+
+template <class _I2C, std::size_t _SIZE>
+std::size_t I2CQueue_<_I2C, _SIZE>::_count = 0;
+
+template <class _I2C, std::size_t _SIZE>
+thread_t * I2CQueue_<_I2C, _SIZE>::_thread = nullptr;
+
+NAMESPACE_CORE_HW_END
@@ -0,0 +1,302 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/hw/namespace.hpp>
+#include <core/hw/common.hpp>
+
+#include <core/hw/I2C.hpp>
+#include <core/hw/Delegate.hpp>
+
+#include <type_traits>
+
+#include "hal.h"
+
+NAMESPACE_CORE_HW_BEGIN
+
+/*! \brief Periodic I2C transaction
+ *
+ * The job is owned by the caller and must stay alive while scheduled.
+ */
+struct I2CPollJob {
+    /*! \brief Completion callback
+     *
+     * Invoked from the scheduler thread, with the transaction outcome.
+     */
+    using Callback = Delegate<void(I2CPollJob&, bool)>;
+
+    /*! \brief Job statistics
+     *
+     * Times are expressed in system ticks.
+     */
+    struct Statistics {
+        uint32_t  runs; //!< Number of executions
+        uint32_t  misses; //!< Number of missed deadlines (including skipped periods)
+        uint32_t  errors; //!< Number of failed transactions
+        systime_t jitter; //!< Release to start delay of the last execution
+        systime_t max_jitter; //!< Longest release to start delay
+    };
+
+    I2CMaster::Address address; //!< Slave address
+    size_t      n_tx; //!< Number of bytes to transmit
+    const void* txbuf; //!< Transmit buffer
+    size_t      n_rx; //!< Number of bytes to receive
+    void*       rxbuf; //!< Receive buffer
+    systime_t   period; //!< Period, in system ticks
+    systime_t   deadline; //!< Relative deadline, in system ticks (0 for the period)
+    Callback    callback; //!< Completion callback (optional)
+    mailbox_t*  mailbox; //!< Mailbox the job is posted to on completion (optional)
+
+    Statistics statistics; //!< Statistics, maintained by the scheduler
+    systime_t  release; //!< Next release time, maintained by the scheduler
+};
+
+/*! \brief Earliest deadline first I2C polling scheduler
+ *
+ * Periodic jobs are released at their period and executed by a single
+ * thread per bus in earliest deadline first order. All the jobs released
+ * at the same time are executed back to back within one bus acquisition.
+ *
+ * The scheduler thread must be created by the application, using
+ * polling() as thread function.
+ *
+ * \tparam _I2C I2CDriverTraits driver
+ * \tparam _MAX_JOBS maximum number of scheduled jobs
+ */
+template <class _I2C, std::size_t _MAX_JOBS = 16>
+class I2CScheduler_
+{
+public:
+    using I2C = _I2C;
+
+    /*! \brief Schedule a job
+     *
+     * The first execution is released immediately.
+     *
+     * \return false if the job table is full
+     */
+    static bool
+    add(
+        I2CPollJob& job
+    )
+    {
+        CORE_ASSERT(job.period > 0);
+
+        bool success = false;
+
+        job.statistics = I2CPollJob::Statistics();
+
+        chSysLock();
+
+        if (_count < _MAX_JOBS) {
+            job.release     = chVTGetSystemTimeX();
+            _jobs[_count++] = &job;
+            success         = true;
+
+            if (_thread != nullptr) {
+                chEvtSignalI(_thread, EVENT_MASK(0));
+            }
+        }
+
+        chSysUnlock();
+
+        return success;
+    } // add
+
+    /*! \brief Unschedule a job
+     *
+     * A job being executed completes its current execution.
+     */
+    static void
+    remove(
+        I2CPollJob& job
+    )
+    {
+        chSysLock();
+
+        for (std::size_t i = 0; i < _count; i++) {
+            if (_jobs[i] == &job) {
+                _jobs[i] = _jobs[--_count];
+                break;
+            }
+        }
+
+        chSysUnlock();
+    }
+
+    /*! \brief Scheduler thread function
+     *
+     */
+    static void
+    polling(
+        void* args
+    )
+    {
+        (void)args;
+
+        I2CMaster_<I2C> master;
+
+        _thread = chThdGetSelfX();
+
+        while (!chThdShouldTerminateX()) {
+            bool acquired = false;
+
+            for (I2CPollJob* job = _next(); job != nullptr; job = _next()) {
+                if (!acquired) {
+                    master.acquireBus();
+                    acquired = true;
+                }
+
+                _run(master, *job);
+            }
+
+            if (acquired) {
+                master.releaseBus();
+            }
+
+            chEvtWaitAnyTimeout(EVENT_MASK(0), _wait());
+        }
+
+        _thread = nullptr;
+    } // polling
+
+private:
+    using Signed = typename std::make_signed<systime_t>::type;
+
+    static I2CPollJob* _jobs[_MAX_JOBS];
+    static std::size_t _count;
+    static thread_t*   _thread;
+
+    static inline systime_t
+    _deadline(
+        const I2CPollJob& job
+    )
+    {
+        return job.release + ((job.deadline != 0) ? job.deadline : job.period);
+    }
+
+    static I2CPollJob*
+    _next()
+    {
+        I2CPollJob* next = nullptr;
+
+        chSysLock();
+
+        systime_t now = chVTGetSystemTimeX();
+
+        for (std::size_t i = 0; i < _count; i++) {
+            I2CPollJob* job = _jobs[i];
+
+            if (static_cast<Signed>(now - job->release) < 0) {
+                continue; // Not released yet
+            }
+
+            if ((next == nullptr) || (static_cast<Signed>(_deadline(*job) - _deadline(*next)) < 0)) {
+                next = job;
+            }
+        }
+
+        chSysUnlock();
+
+        return next;
+    } // _next
+
+    static systime_t
+    _wait()
+    {
+        systime_t wait = TIME_INFINITE;
+
+        chSysLock();
+
+        systime_t now = chVTGetSystemTimeX();
+
+        for (std::size_t i = 0; i < _count; i++) {
+            Signed delta = static_cast<Signed>(_jobs[i]->release - now);
+
+            if (delta <= 0) {
+                wait = TIME_IMMEDIATE;
+                break;
+            }
+
+            if ((wait == TIME_INFINITE) || (static_cast<systime_t>(delta) < wait)) {
+                wait = static_cast<systime_t>(delta);
+            }
+        }
+
+        chSysUnlock();
+
+        return wait;
+    } // _wait
+
+    static void
+    _run(
+        I2CMaster_<I2C>& master,
+        I2CPollJob&      job
+    )
+    {
+        systime_t start    = chVTGetSystemTimeX();
+        systime_t deadline = _deadline(job);
+        msg_t     msg;
+
+        job.statistics.runs++;
+        job.statistics.jitter = start - job.release;
+
+        if (job.statistics.jitter > job.statistics.max_jitter) {
+            job.statistics.max_jitter = job.statistics.jitter;
+        }
+
+        // A transaction is not allowed to last longer than its period
+        if (job.n_tx > 0) {
+            msg = ::i2cMasterTransmitTimeout(I2C::driver, job.address & 0x7F, reinterpret_cast<const uint8_t*>(job.txbuf), job.n_tx, reinterpret_cast<uint8_t*>(job.rxbuf), job.n_rx, job.period);
+        } else {
+            msg = ::i2cMasterReceiveTimeout(I2C::driver, job.address & 0x7F, reinterpret_cast<uint8_t*>(job.rxbuf), job.n_rx, job.period);
+        }
+
+        bool success = (msg == MSG_OK);
+
+        if (!success) {
+            job.statistics.errors++;
+
+            if (msg == MSG_TIMEOUT) {
+                master.recover();
+            }
+        }
+
+        systime_t end = chVTGetSystemTimeX();
+
+        if (static_cast<Signed>(end - deadline) > 0) {
+            job.statistics.misses++;
+        }
+
+        // Next release, skipping the periods that have already elapsed
+        job.release += job.period;
+
+        while (static_cast<Signed>(end - _deadline(job)) > 0) {
+            job.release += job.period;
+            job.statistics.misses++;
+        }
+
+        if (job.callback) {
+            job.callback(job, success);
+        }
+
+        if (job.mailbox != nullptr) {
+            chMBPostTimeout(job.mailbox, reinterpret_cast<msg_t>(&job), TIME_IMMEDIATE);
+        }
+    } // _run
+};
+
+template <class _I2C, std::size_t _MAX_JOBS>
+I2CPollJob * I2CScheduler_<_I2C, _MAX_JOBS>::_jobs[_MAX_JOBS];
+
+template <class _I2C, std::size_t _MAX_JOBS>
+std::size_t I2CScheduler_<_I2C, _MAX_JOBS>::_count = 0;
+
+template <class _I2C, std::size_t _MAX_JOBS>
+thread_t * I2CScheduler_<_I2C, _MAX_JOBS>::_thread = nullptr;
+
+NAMESPACE_CORE_HW_END
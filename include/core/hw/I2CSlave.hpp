@@ -0,0 +1,456 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/hw/namespace.hpp>
+#include <core/hw/common.hpp>
+
+#include <core/hw/I2C.hpp>
+#include <core/hw/Delegate.hpp>
+
+#include <cstring>
+
+#include "hal.h"
+
+NAMESPACE_CORE_HW_BEGIN
+
+template <std::size_t S>
+struct I2CSlaveTraits {};
+
+#if defined(I2C_OAR1_OA1EN) // I2Cv2 peripheral
+
+/* The peripheral used as slave must not be enabled in the HAL, whose
+ * driver would otherwise own its interrupt vectors.
+ */
+
+#if defined(I2C1) && !STM32_I2C_USE_I2C1
+template <>
+struct I2CSlaveTraits<1> {
+    static constexpr uint32_t EVENT_IRQ = STM32_I2C1_EVENT_NUMBER;
+    static constexpr uint32_t ERROR_IRQ = STM32_I2C1_ERROR_NUMBER;
+    static constexpr uint32_t PRIORITY  = STM32_I2C_I2C1_IRQ_PRIORITY;
+
+    static inline I2C_TypeDef*
+    i2c()
+    {
+        return I2C1;
+    }
+
+    static inline void
+    enable()
+    {
+        rccEnableI2C1(true);
+    }
+
+    static inline void
+    disable()
+    {
+        rccDisableI2C1(true);
+    }
+};
+#endif
+
+#if defined(I2C2) && !STM32_I2C_USE_I2C2
+template <>
+struct I2CSlaveTraits<2> {
+    static constexpr uint32_t EVENT_IRQ = STM32_I2C2_EVENT_NUMBER;
+    static constexpr uint32_t ERROR_IRQ = STM32_I2C2_ERROR_NUMBER;
+    static constexpr uint32_t PRIORITY  = STM32_I2C_I2C2_IRQ_PRIORITY;
+
+    static inline I2C_TypeDef*
+    i2c()
+    {
+        return I2C2;
+    }
+
+    static inline void
+    enable()
+    {
+        rccEnableI2C2(true);
+    }
+
+    static inline void
+    disable()
+    {
+        rccDisableI2C2(true);
+    }
+};
+#endif
+
+#if defined(I2C3) && !STM32_I2C_USE_I2C3
+template <>
+struct I2CSlaveTraits<3> {
+    static constexpr uint32_t EVENT_IRQ = STM32_I2C3_EVENT_NUMBER;
+    static constexpr uint32_t ERROR_IRQ = STM32_I2C3_ERROR_NUMBER;
+    static constexpr uint32_t PRIORITY  = STM32_I2C_I2C3_IRQ_PRIORITY;
+
+    static inline I2C_TypeDef*
+    i2c()
+    {
+        return I2C3;
+    }
+
+    static inline void
+    enable()
+    {
+        rccEnableI2C3(true);
+    }
+
+    static inline void
+    disable()
+    {
+        rccDisableI2C3(true);
+    }
+};
+#endif
+
+#endif // if defined(I2C_OAR1_OA1EN)
+
+/*! \brief Defines the interrupt handlers of an I2C slave
+ *
+ * To be used once, at global scope, in a source file.
+ *
+ * \param N peripheral number
+ * \param SLAVE fully qualified I2CSlave_ type
+ */
+#define CORE_HW_I2C_SLAVE_IRQ_HANDLERS(N, SLAVE) \
+    extern "C" { \
+    OSAL_IRQ_HANDLER(STM32_I2C ## N ## _EVENT_HANDLER) { \
+        OSAL_IRQ_PROLOGUE(); \
+        SLAVE::serveEventInterrupt(); \
+        OSAL_IRQ_EPILOGUE(); \
+    } \
+    OSAL_IRQ_HANDLER(STM32_I2C ## N ## _ERROR_HANDLER) { \
+        OSAL_IRQ_PROLOGUE(); \
+        SLAVE::serveErrorInterrupt(); \
+        OSAL_IRQ_EPILOGUE(); \
+    } \
+    }
+
+/*! \brief I2C slave exposing a register file
+ *
+ */
+class I2CSlave
+{
+public:
+    using Address = i2caddr_t;
+
+    /*! \brief Write callback
+     *
+     * Invoked from ISR context once per master write transaction, with the
+     * register offset and the bytes written after the register pointer.
+     */
+    using Callback = Delegate<void(std::size_t, const uint8_t*, std::size_t)>;
+
+public:
+    virtual void
+    start(
+        Address          address, //!< [in] 7 bit slave address
+        const I2CConfig& config //!< [in] peripheral configuration (timing)
+    ) = 0;
+
+    virtual void
+    stop() = 0;
+
+    virtual void
+    setCallback(
+        Callback callback //!< callback function
+    ) = 0;
+
+    virtual void
+    resetCallback() = 0;
+
+    /*! \brief Update the register file
+     *
+     * Changes are visible to the master only after commit().
+     */
+    virtual void
+    write(
+        std::size_t offset, //!< [in] register offset
+        const void* data, //!< [in] register values
+        std::size_t n //!< [in] number of bytes
+    ) = 0;
+
+    /*! \brief Publish the register file
+     *
+     */
+    virtual void
+    commit() = 0;
+};
+
+/*! \brief I2C slave exposing a register file
+ *
+ * The master writes the register pointer as first byte of a write
+ * transaction; the pointer auto-increments over the following bytes and
+ * over reads.
+ *
+ * Reads are served directly from the published snapshot of the register
+ * file, latched at the address match, so a transaction never observes a
+ * partial update. Updates are made on a separate buffer and published
+ * with commit(); a spare buffer lets commit() proceed while the master is
+ * reading the previous snapshot.
+ *
+ * The interrupt handlers must be defined with
+ * CORE_HW_I2C_SLAVE_IRQ_HANDLERS().
+ *
+ * \tparam _I2C I2CSlaveTraits peripheral
+ * \tparam _SIZE register file size
+ */
+template <class _I2C, std::size_t _SIZE>
+class I2CSlave_:
+    public I2CSlave
+{
+    static_assert(_SIZE <= 256, "Register file cannot exceed the register pointer range");
+
+public:
+    using I2C = _I2C;
+
+public:
+    inline void
+    start(
+        Address          address,
+        const I2CConfig& config
+    )
+    {
+        I2C_TypeDef* i2c = I2C::i2c();
+
+        _front   = 0;
+        _back    = 1;
+        _reading = NONE;
+        _pointer = 0;
+        _count   = 0;
+        _writing = false;
+        std::memset(_buffers, 0, sizeof(_buffers));
+
+        I2C::enable();
+
+        i2c->CR1     = 0;
+        i2c->TIMINGR = config.timingr;
+        i2c->OAR1    = 0;
+        i2c->OAR1    = I2C_OAR1_OA1EN | ((address & 0x7F) << 1);
+        i2c->OAR2    = 0;
+        i2c->CR2     = 0;
+
+        nvicEnableVector(I2C::EVENT_IRQ, I2C::PRIORITY);
+        nvicEnableVector(I2C::ERROR_IRQ, I2C::PRIORITY);
+
+        i2c->CR1 = I2C_CR1_PE | I2C_CR1_ADDRIE | I2C_CR1_RXIE | I2C_CR1_TXIE | I2C_CR1_STOPIE | I2C_CR1_NACKIE | I2C_CR1_ERRIE;
+    }
+
+    inline void
+    stop()
+    {
+        I2C::i2c()->CR1 = 0;
+
+        nvicDisableVector(I2C::EVENT_IRQ);
+        nvicDisableVector(I2C::ERROR_IRQ);
+
+        I2C::disable();
+    }
+
+    inline void
+    setCallback(
+        Callback callback
+    )
+    {
+        _callback_impl = callback;
+    }
+
+    inline void
+    resetCallback()
+    {
+        _callback_impl = nullptr;
+    }
+
+    inline void
+    write(
+        std::size_t offset,
+        const void* data,
+        std::size_t n
+    )
+    {
+        CORE_ASSERT(offset + n <= _SIZE);
+
+        std::memcpy(&_buffers[_back][offset], data, n);
+    }
+
+    inline void
+    commit()
+    {
+        chSysLock();
+
+        std::size_t published = _back;
+
+        // Any buffer that is neither published nor being read
+        for (std::size_t i = 0; i < BUFFERS; i++) {
+            if ((i != published) && (i != _reading)) {
+                _back = i;
+                break;
+            }
+        }
+
+        _front = published;
+
+        chSysUnlock();
+
+        std::memcpy(_buffers[_back], _buffers[_front], _SIZE);
+    } // commit
+
+    static void
+    serveEventInterrupt()
+    {
+        I2C_TypeDef* i2c = I2C::i2c();
+        uint32_t     isr = i2c->ISR;
+
+        if (isr & I2C_ISR_ADDR) {
+            _endWrite();
+            _endRead();
+
+            if (isr & I2C_ISR_DIR) {
+                // Master read: latch the snapshot, flush the transmit register
+                chSysLockFromISR();
+                _reading = _front;
+                chSysUnlockFromISR();
+
+                _index   = _pointer;
+                i2c->ISR = I2C_ISR_TXE;
+            } else {
+                _writing = true;
+                _count   = 0;
+            }
+
+            i2c->ICR = I2C_ICR_ADDRCF;
+        }
+
+        if (isr & I2C_ISR_RXNE) {
+            uint8_t data = i2c->RXDR;
+
+            if (_count == 0) {
+                _pointer = data;
+            } else if (_count <= _SIZE) {
+                _incoming[_count - 1] = data;
+            }
+
+            _count++;
+        }
+
+        if (isr & I2C_ISR_TXIS) {
+            i2c->TXDR = (_index < _SIZE) ? _buffers[_reading][_index] : 0xFF;
+            _index++;
+        }
+
+        if (isr & I2C_ISR_NACKF) {
+            i2c->ICR = I2C_ICR_NACKCF;
+        }
+
+        if (isr & I2C_ISR_STOPF) {
+            i2c->ICR = I2C_ICR_STOPCF;
+
+            _endWrite();
+            _endRead();
+        }
+    } // serveEventInterrupt
+
+    static void
+    serveErrorInterrupt()
+    {
+        I2C_TypeDef* i2c = I2C::i2c();
+
+        i2c->ICR = I2C_ICR_BERRCF | I2C_ICR_ARLOCF | I2C_ICR_OVRCF;
+
+        // Drop the current transaction
+        _writing = false;
+
+        chSysLockFromISR();
+        _reading = NONE;
+        chSysUnlockFromISR();
+    }
+
+private:
+    static const std::size_t BUFFERS = 3;
+    static const std::size_t NONE    = BUFFERS;
+
+    static Callback    _callback_impl;
+    static uint8_t     _buffers[BUFFERS][_SIZE];
+    static uint8_t     _incoming[_SIZE];
+    static std::size_t _front;
+    static std::size_t _back;
+    static std::size_t _reading;
+    static std::size_t _pointer;
+    static std::size_t _index;
+    static std::size_t _count;
+    static bool        _writing;
+
+    static inline void
+    _endWrite()
+    {
+        if (_writing) {
+            _writing = false;
+
+            std::size_t n = (_count > 1) ? (_count - 1) : 0;
+
+            if (_pointer + n > _SIZE) {
+                n = (_pointer < _SIZE) ? (_SIZE - _pointer) : 0;
+            }
+
+            if ((n > 0) && _callback_impl) {
+                _callback_impl(_pointer, _incoming, n);
+            }
+
+            _pointer += n;
+        }
+    }
+
+    static inline void
+    _endRead()
+    {
+        if (_reading != NONE) {
+            // The register pointer auto-increments over the bytes read. The
+            // transmit register is loaded one byte ahead, and the byte still
+            // in it when the master NACKs has not been sent.
+            if (_index > _pointer) {
+                _pointer = _index - 1;
+            }
+
+            chSysLockFromISR();
+            _reading = NONE;
+            chSysUnlockFromISR();
+        }
+    }
+};
+
+template <class _I2C, std::size_t _SIZE>
+I2CSlave::Callback I2CSlave_<_I2C, _SIZE>::_callback_impl;
+
+template <class _I2C, std::size_t _SIZE>
+uint8_t I2CSlave_<_I2C, _SIZE>::_buffers[BUFFERS][_SIZE];
+
+template <class _I2C, std::size_t _SIZE>
+uint8_t I2CSlave_<_I2C, _SIZE>::_incoming[_SIZE];
+
+template <class _I2C, std::size_t _SIZE>
+std::size_t I2CSlave_<_I2C, _SIZE>::_front = 0;
+
+template <class _I2C, std::size_t _SIZE>
+std::size_t I2CSlave_<_I2C, _SIZE>::_back = 1;
+
+template <class _I2C, std::size_t _SIZE>
+std::size_t I2CSlave_<_I2C, _SIZE>::_reading = I2CSlave_<_I2C, _SIZE>::NONE;
+
+template <class _I2C, std::size_t _SIZE>
+std::size_t I2CSlave_<_I2C, _SIZE>::_pointer = 0;
+
+template <class _I2C, std::size_t _SIZE>
+std::size_t I2CSlave_<_I2C, _SIZE>::_index = 0;
+
+template <class _I2C, std::size_t _SIZE>
+std::size_t I2CSlave_<_I2C, _SIZE>::_count = 0;
+
+template <class _I2C, std::size_t _SIZE>
+bool I2CSlave_<_I2C, _SIZE>::_writing = false;
+
+NAMESPACE_CORE_HW_END
@@ -9,7 +9,7 @@
 #include <core/hw/namespace.hpp>
 #include <core/hw/common.hpp>
 
-#include <functional>
+#include <core/hw/Delegate.hpp>
 
 #include "hal.h"
 
@@ -89,7 +89,7 @@ public:
     virtual void
     setLevel(Level level) = 0;
 
-    virtual void
+    virtual bool
     setFrequency(
         uint32_t frequency
     ) = 0;
@@ -105,7 +105,7 @@ public:
 
     virtual void
     setWidthCallback(
-    	std::function<void(uint32_t)>&& callback
+    	Delegate<void(uint32_t)> callback
     ) = 0;
 
     virtual void
@@ -113,7 +113,7 @@ public:
 
     virtual void
     setPeriodCallback(
-    	std::function<void(uint32_t)>&& callback
+    	Delegate<void(uint32_t)> callback
     ) = 0;
 
     virtual void
@@ -121,7 +121,7 @@ public:
 
     virtual void
     setOverflowCallback(
-    	std::function<void()>&& callback
+    	Delegate<void()> callback
     ) = 0;
 
     virtual void
@@ -182,6 +182,11 @@ public:
     	::icuStop(ICU::driver);
     }
 
+    /*! \brief Set the active level
+     *
+     * While the driver is running, the capture polarities are changed in
+     * place.
+     */
     inline void
     setLevel(Level level)
     {
@@ -196,24 +201,58 @@ public:
 			  break;
 		}
 
-		if (ICU::driver->state == ICU_READY) {
-			stop();
-			::icuStart(ICU::driver, &_configuration);
+		if (_running()) {
+			// Polarity bits are not preloaded, captures go on with the new level
+			stm32_tim_t* tim = ICU::driver->tim;
+			bool high = (_configuration.mode == ICU_INPUT_ACTIVE_HIGH);
+			uint32_t ccer = STM32_TIM_CCER_CC1E | STM32_TIM_CCER_CC2E;
+
+			if (high == (CHANNEL == 1)) {
+				ccer |= STM32_TIM_CCER_CC2P;
+			} else {
+				ccer |= STM32_TIM_CCER_CC1P;
+			}
+
+			chSysLock();
+			tim->CCER = (tim->CCER & ~(STM32_TIM_CCER_CC1P | STM32_TIM_CCER_CC2P)) | ccer;
+			chSysUnlock();
 		}
     }
 
-    inline void
+    /*! \brief Set the counter frequency
+     *
+     * While the driver is running, the prescaler is reloaded at the next
+     * update event (the next period edge, or a counter overflow) without
+     * stopping the captures.
+     *
+     * \return false if the frequency is not an exact divider of the timer
+     * clock, in which case nothing is changed
+     */
+    inline bool
 	setFrequency(
 		uint32_t frequency
 	)
 	{
-    	_configuration.frequency = frequency;
+		if (frequency == 0) {
+			return false;
+		}
+
+		if (_running()) {
+			uint32_t psc = (ICU::driver->clock / frequency) - 1;
 
-		if (ICU::driver->state == ICU_READY) {
-			stop();
-			::icuStart(ICU::driver, &_configuration);
+			// A restart would not help, the HAL requires the same
+			if ((((psc + 1) * frequency) != ICU::driver->clock) || (psc > 0xFFFF)) {
+				return false;
+			}
+
+			// PSC is preloaded
+			ICU::driver->tim->PSC = psc;
 		}
-	}
+
+    	_configuration.frequency = frequency;
+
+		return true;
+	} // setFrequency
 
     inline void
     enable()
@@ -239,10 +278,10 @@ public:
 
     inline void
 	setWidthCallback(
-		std::function<void(uint32_t)>&& callback
+		Delegate<void(uint32_t)> callback
     )
     {
-    	_width_callback_impl = std::move(callback);
+    	_width_callback_impl = callback;
 
     	_configuration.width_cb = _width_callback;
     }
@@ -255,10 +294,10 @@ public:
 
     inline void
 	setPeriodCallback(
-		std::function<void(uint32_t)>&& callback
+		Delegate<void(uint32_t)> callback
     )
     {
-    	_period_callback_impl = std::move(callback);
+    	_period_callback_impl = callback;
 
     	_configuration.period_cb = _period_callback;
     }
@@ -271,10 +310,10 @@ public:
 
     inline void
 	setOverflowCallback(
-		std::function<void()>&& callback
+		Delegate<void()> callback
     )
     {
-    	_overflow_callback_impl = std::move(callback);
+    	_overflow_callback_impl = callback;
 
     	_configuration.overflow_cb = _overflow_callback;
     }
@@ -287,6 +326,12 @@ public:
 private:
     Configuration _configuration;
 
+    static inline bool
+    _running()
+    {
+    	return (ICU::driver->state != ICU_UNINIT) && (ICU::driver->state != ICU_STOP);
+    }
+
     static inline void
     _width_callback(
     	ICUDriver *icup
@@ -311,19 +356,190 @@ private:
     	_overflow_callback_impl();
     }
 
-    static std::function<void(uint32_t)> _width_callback_impl;
-    static std::function<void(uint32_t)> _period_callback_impl;
-    static std::function<void()> _overflow_callback_impl;
+    static Delegate<void(uint32_t)> _width_callback_impl;
+    static Delegate<void(uint32_t)> _period_callback_impl;
+    static Delegate<void()>         _overflow_callback_impl;
 };
 
 template <class _ICU, std::size_t _CHANNEL>
-std::function<void(uint32_t)>ICUChannel_<_ICU, _CHANNEL>::_width_callback_impl;
+Delegate<void(uint32_t)> ICUChannel_<_ICU, _CHANNEL>::_width_callback_impl;
 
 template <class _ICU, std::size_t _CHANNEL>
-std::function<void(uint32_t)>ICUChannel_<_ICU, _CHANNEL>::_period_callback_impl;
+Delegate<void(uint32_t)> ICUChannel_<_ICU, _CHANNEL>::_period_callback_impl;
 
 template <class _ICU, std::size_t _CHANNEL>
-std::function<void()>ICUChannel_<_ICU, _CHANNEL>::_overflow_callback_impl;
+Delegate<void()> ICUChannel_<_ICU, _CHANNEL>::_overflow_callback_impl;
+
+#ifndef CORE_HW_ICU_DMA_PRIORITY
+#define CORE_HW_ICU_DMA_PRIORITY 2
+#endif
+
+#ifndef CORE_HW_ICU_DMA_IRQ_PRIORITY
+#define CORE_HW_ICU_DMA_IRQ_PRIORITY 10
+#endif
+
+/*! \brief ICU channel with DMA burst capture
+ *
+ * The timer runs in PWM input mode, so it resets at every period edge and
+ * both the period and the width are read directly from the capture
+ * registers. Each period edge triggers a DMA burst through DMAR that
+ * copies CCR1 and CCR2 into a circular buffer: no interrupt is taken per
+ * edge, and batches of samples are delivered on half and full transfer.
+ *
+ * \tparam _ICU ICUDriverTraits driver
+ * \tparam _CHANNEL input channel (1 or 2)
+ * \tparam _DMA_STREAM DMA stream serving the channel CC request, as STM32_DMA_STREAM_ID()
+ * \tparam _DMA_CHANNEL DMA request channel (ignored on devices without request selection)
+ * \tparam _SIZE number of samples in the circular buffer
+ */
+template <class _ICU, std::size_t _CHANNEL, uint32_t _DMA_STREAM, uint32_t _DMA_CHANNEL = 0, std::size_t _SIZE = 64>
+class ICUBurstCapture_
+{
+    static_assert(_CHANNEL > 0 && _CHANNEL < 3, "CHANNEL must be 1 or 2");
+    static_assert((_SIZE >= 2) && ((_SIZE % 2) == 0), "Buffer size must be even");
+
+public:
+    using ICU = _ICU;
+
+    /*! \brief Captured sample
+     *
+     * Laid out as the CCR1, CCR2 burst.
+     */
+    struct Sample {
+        uint16_t ccr[2];
+
+        inline uint16_t
+        period() const
+        {
+            return ccr[_CHANNEL - 1];
+        }
+
+        inline uint16_t
+        width() const
+        {
+            return ccr[2 - _CHANNEL];
+        }
+    };
+
+    /*! \brief Batch callback
+     *
+     * Invoked from ISR context with _SIZE / 2 samples, which stay valid
+     * until the DMA wraps around on them.
+     */
+    using Callback = Delegate<void(const Sample*, std::size_t)>;
+
+public:
+    static void
+    start(
+        const ICUConfig& config,
+        Callback         callback
+    )
+    {
+        _callback_impl = callback;
+        _errors        = 0;
+
+        _configuration             = config;
+        _configuration.channel     = (_CHANNEL == 1) ? ICU_CHANNEL_1 : ICU_CHANNEL_2;
+        _configuration.width_cb    = nullptr;
+        _configuration.period_cb   = nullptr;
+        _configuration.overflow_cb = nullptr;
+        _configuration.dier        = (_CHANNEL == 1) ? STM32_TIM_DIER_CC1DE : STM32_TIM_DIER_CC2DE;
+
+        ::icuStart(ICU::driver, &_configuration);
+
+        stm32_tim_t* tim = ICU::driver->tim;
+
+        // Burst of 2 transfers starting from CCR1
+        tim->DCR = STM32_TIM_DCR_DBA(13) | STM32_TIM_DCR_DBL(1);
+
+        bool allocated = !dmaStreamAllocate(STM32_DMA_STREAM(_DMA_STREAM), CORE_HW_ICU_DMA_IRQ_PRIORITY, _serve, nullptr);
+
+        osalDbgAssert(allocated, "stream already allocated");
+        (void)allocated;
+
+        dmaStreamSetPeripheral(STM32_DMA_STREAM(_DMA_STREAM), &tim->DMAR);
+        dmaStreamSetMemory0(STM32_DMA_STREAM(_DMA_STREAM), _buffer);
+        dmaStreamSetTransactionSize(STM32_DMA_STREAM(_DMA_STREAM), 2 * _SIZE);
+        dmaStreamSetMode(STM32_DMA_STREAM(_DMA_STREAM), _mode());
+        dmaStreamEnable(STM32_DMA_STREAM(_DMA_STREAM));
+
+        ::icuStartCapture(ICU::driver);
+    } // start
+
+    static void
+    stop()
+    {
+        ::icuStopCapture(ICU::driver);
+
+        dmaStreamDisable(STM32_DMA_STREAM(_DMA_STREAM));
+        dmaStreamRelease(STM32_DMA_STREAM(_DMA_STREAM));
+
+        ::icuStop(ICU::driver);
+    }
+
+    /*! \brief Number of DMA transfer errors
+     *
+     */
+    static inline uint32_t
+    getErrors()
+    {
+        return _errors;
+    }
+
+private:
+    static ICUConfig _configuration;
+    static Callback  _callback_impl;
+    static Sample    _buffer[_SIZE];
+    static uint32_t  _errors;
+
+    static inline uint32_t
+    _mode()
+    {
+        uint32_t mode = STM32_DMA_CR_DIR_P2M | STM32_DMA_CR_PSIZE_HWORD | STM32_DMA_CR_MSIZE_HWORD | STM32_DMA_CR_MINC | STM32_DMA_CR_CIRC;
+
+        mode |= STM32_DMA_CR_HTIE | STM32_DMA_CR_TCIE | STM32_DMA_CR_TEIE | STM32_DMA_CR_PL(CORE_HW_ICU_DMA_PRIORITY);
+
+#if defined(STM32_DMA_CR_CHSEL)
+        mode |= STM32_DMA_CR_CHSEL(_DMA_CHANNEL);
+#endif
+
+        return mode;
+    }
+
+    static void
+    _serve(
+        void*    p,
+        uint32_t flags
+    )
+    {
+        (void)p;
+
+        if (flags & STM32_DMA_ISR_TEIF) {
+            _errors++;
+        }
+
+        if (flags & STM32_DMA_ISR_HTIF) {
+            _callback_impl(&_buffer[0], _SIZE / 2);
+        }
+
+        if (flags & STM32_DMA_ISR_TCIF) {
+            _callback_impl(&_buffer[_SIZE / 2], _SIZE / 2);
+        }
+    }
+};
+
+template <class _ICU, std::size_t _CHANNEL, uint32_t _DMA_STREAM, uint32_t _DMA_CHANNEL, std::size_t _SIZE>
+ICUConfig ICUBurstCapture_<_ICU, _CHANNEL, _DMA_STREAM, _DMA_CHANNEL, _SIZE>::_configuration;
+
+template <class _ICU, std::size_t _CHANNEL, uint32_t _DMA_STREAM, uint32_t _DMA_CHANNEL, std::size_t _SIZE>
+typename ICUBurstCapture_<_ICU, _CHANNEL, _DMA_STREAM, _DMA_CHANNEL, _SIZE>::Callback ICUBurstCapture_<_ICU, _CHANNEL, _DMA_STREAM, _DMA_CHANNEL, _SIZE>::_callback_impl;
+
+template <class _ICU, std::size_t _CHANNEL, uint32_t _DMA_STREAM, uint32_t _DMA_CHANNEL, std::size_t _SIZE>
+typename ICUBurstCapture_<_ICU, _CHANNEL, _DMA_STREAM, _DMA_CHANNEL, _SIZE>::Sample ICUBurstCapture_<_ICU, _CHANNEL, _DMA_STREAM, _DMA_CHANNEL, _SIZE>::_buffer[_SIZE];
+
+template <class _ICU, std::size_t _CHANNEL, uint32_t _DMA_STREAM, uint32_t _DMA_CHANNEL, std::size_t _SIZE>
+uint32_t ICUBurstCapture_<_ICU, _CHANNEL, _DMA_STREAM, _DMA_CHANNEL, _SIZE>::_errors = 0;
+
 // --- Aliases -----------------------------------------------------------------
 
 using ICU_1 = ICUDriverTraits<1>;
@@ -0,0 +1,263 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/hw/namespace.hpp>
+#include <core/hw/common.hpp>
+
+#include <core/hw/ICU.hpp>
+#include <core/hw/Snapshot.hpp>
+
+#include <type_traits>
+
+#include "hal.h"
+
+NAMESPACE_CORE_HW_BEGIN
+
+#ifndef CORE_HW_ICU_ESTIMATOR_TIMEOUT
+#define CORE_HW_ICU_ESTIMATOR_TIMEOUT 1000
+#endif
+
+/*! \brief Frequency and duty estimate
+ *
+ */
+struct ICUEstimate {
+    bool     valid; //!< false if no complete window has been measured within the timeout
+    uint32_t frequency; //!< Frequency, in mHz
+    uint32_t duty; //!< Duty cycle, Q16 (65536 is 100%)
+    uint32_t period; //!< Average period, in ICU ticks
+};
+
+/*! \brief Frequency and duty estimator
+ *
+ * Averages the periods and widths measured by an ICU channel over a window
+ * of periods, or over a time gate, and publishes the result through a lock
+ * free snapshot.
+ *
+ * Periods longer than the 16 bit capture range are supported: the number
+ * of counter wraps between two edges is resolved from the cycle counter.
+ * The ICU overflow notification cannot be used for that, as the HAL drops
+ * the capture that follows an overflow. The ICU clock must not be faster
+ * than the core clock.
+ *
+ * A signal that produces no complete window within the timeout is
+ * reported as not valid, instead of keeping the last value.
+ *
+ * \tparam _ICU ICUDriverTraits driver
+ * \tparam _CHANNEL input channel (1 or 2)
+ * \tparam _WINDOW number of periods averaged
+ */
+template <class _ICU, std::size_t _CHANNEL, std::size_t _WINDOW = 8>
+class ICUEstimator_
+{
+    static_assert(_WINDOW > 0, "Window must contain at least one period");
+
+public:
+    using ICU = _ICU;
+
+public:
+    static void
+    start(
+        const ICUConfig& config
+    )
+    {
+        CORE_ASSERT(config.frequency <= STM32_HCLK);
+
+        // Timer ticks per core cycle, Q32
+        _ratio = (static_cast<uint64_t>(config.frequency) << 32) / STM32_HCLK;
+
+        chSysLock();
+        _synced = false;
+        _reset();
+        chSysUnlock();
+
+        _channel.start(config);
+        _channel.resetOverflowCallback();
+        _channel.setWidthCallback(_width);
+        _channel.setPeriodCallback(_period);
+        _channel.enable();
+        _channel.enableCallbacks();
+    }
+
+    static void
+    stop()
+    {
+        _channel.disableCallbacks();
+        _channel.disable();
+        _channel.stop();
+    }
+
+    /*! \brief Set a time gate
+     *
+     * A window is closed as soon as it spans the given number of ICU ticks,
+     * even if it contains less than _WINDOW periods. 0 disables the gate.
+     */
+    static void
+    setGate(
+        uint64_t ticks
+    )
+    {
+        chSysLock();
+        _gate = ticks;
+        chSysUnlock();
+    }
+
+    static void
+    setTimeout(
+        systime_t timeout
+    )
+    {
+        _timeout = timeout;
+    }
+
+    /*! \brief Get the last estimate
+     *
+     * \return true if the estimate is valid
+     */
+    static bool
+    get(
+        ICUEstimate& estimate
+    )
+    {
+        Window window;
+
+        _snapshot.read(window);
+
+        using Signed = typename std::make_signed<systime_t>::type;
+
+        estimate.valid = (window.count > 0) && (window.period > 0) && (static_cast<Signed>(chVTGetSystemTimeX() - window.time) <= static_cast<Signed>(_timeout));
+
+        if (!estimate.valid) {
+            estimate.frequency = 0;
+            estimate.duty      = 0;
+            estimate.period    = 0;
+            return false;
+        }
+
+        estimate.frequency = static_cast<uint32_t>((static_cast<uint64_t>(ICU::driver->config->frequency) * 1000 * window.count) / window.period);
+        estimate.duty      = static_cast<uint32_t>((window.width << 16) / window.period);
+        estimate.period    = static_cast<uint32_t>(window.period / window.count);
+
+        return true;
+    } // get
+
+private:
+    struct Window {
+        uint64_t  period; //!< Sum of the periods, in ticks
+        uint64_t  width; //!< Sum of the widths, in ticks
+        uint32_t  count; //!< Number of periods
+        systime_t time; //!< Publication time
+    };
+
+    static ICUChannel_<_ICU, _CHANNEL> _channel;
+    static Snapshot_<Window> _snapshot;
+    static Window            _window;
+    static uint64_t          _ratio;
+    static uint64_t          _gate;
+    static systime_t         _timeout;
+    static rtcnt_t           _edge;
+    static uint32_t          _pending_width;
+    static bool              _synced;
+
+    static inline void
+    _reset()
+    {
+        _window.period = 0;
+        _window.width  = 0;
+        _window.count  = 0;
+        _pending_width = 0;
+    }
+
+    /*! \brief Extend a 16 bit capture
+     *
+     * The expected number of ticks is computed from the cycles elapsed
+     * since the last period edge, and the capture is extended by the
+     * number of counter wraps that best matches it.
+     */
+    static inline uint32_t
+    _extend(
+        uint32_t capture,
+        rtcnt_t  now
+    )
+    {
+        uint32_t expected = static_cast<uint32_t>((static_cast<uint64_t>(now - _edge) * _ratio) >> 32);
+        uint32_t wraps    = (expected > capture) ? ((expected - capture + 0x8000) >> 16) : 0;
+
+        return capture + (wraps << 16);
+    }
+
+    static void
+    _width(
+        uint32_t width
+    )
+    {
+        rtcnt_t now = chSysGetRealtimeCounterX();
+
+        if (_synced) {
+            _pending_width = _extend(width, now);
+        }
+    }
+
+    static void
+    _period(
+        uint32_t period
+    )
+    {
+        rtcnt_t now = chSysGetRealtimeCounterX();
+
+        if (!_synced) {
+            // The first edge only gives the reference
+            _synced = true;
+            _edge   = now;
+            return;
+        }
+
+        _window.period += _extend(period, now);
+        _window.width  += _pending_width;
+        _window.count++;
+        _pending_width  = 0;
+        _edge           = now;
+
+        if ((_window.count >= _WINDOW) || ((_gate != 0) && (_window.period >= _gate))) {
+            chSysLockFromISR();
+            _window.time = chVTGetSystemTimeX();
+            chSysUnlockFromISR();
+
+            _snapshot.publish(_window);
+            _reset();
+        }
+    } // _period
+};
+
+template <class _ICU, std::size_t _CHANNEL, std::size_t _WINDOW>
+ICUChannel_<_ICU, _CHANNEL> ICUEstimator_<_ICU, _CHANNEL, _WINDOW>::_channel;
+
+template <class _ICU, std::size_t _CHANNEL, std::size_t _WINDOW>
+Snapshot_<typename ICUEstimator_<_ICU, _CHANNEL, _WINDOW>::Window> ICUEstimator_<_ICU, _CHANNEL, _WINDOW>::_snapshot;
+
+template <class _ICU, std::size_t _CHANNEL, std::size_t _WINDOW>
+typename ICUEstimator_<_ICU, _CHANNEL, _WINDOW>::Window ICUEstimator_<_ICU, _CHANNEL, _WINDOW>::_window;
+
+template <class _ICU, std::size_t _CHANNEL, std::size_t _WINDOW>
+uint64_t ICUEstimator_<_ICU, _CHANNEL, _WINDOW>::_ratio = 0;
+
+template <class _ICU, std::size_t _CHANNEL, std::size_t _WINDOW>
+uint64_t ICUEstimator_<_ICU, _CHANNEL, _WINDOW>::_gate = 0;
+
+template <class _ICU, std::size_t _CHANNEL, std::size_t _WINDOW>
+systime_t ICUEstimator_<_ICU, _CHANNEL, _WINDOW>::_timeout = MS2ST(CORE_HW_ICU_ESTIMATOR_TIMEOUT);
+
+template <class _ICU, std::size_t _CHANNEL, std::size_t _WINDOW>
+rtcnt_t ICUEstimator_<_ICU, _CHANNEL, _WINDOW>::_edge = 0;
+
+template <class _ICU, std::size_t _CHANNEL, std::size_t _WINDOW>
+uint32_t ICUEstimator_<_ICU, _CHANNEL, _WINDOW>::_pending_width = 0;
+
+template <class _ICU, std::size_t _CHANNEL, std::size_t _WINDOW>
+bool ICUEstimator_<_ICU, _CHANNEL, _WINDOW>::_synced = false;
+
+NAMESPACE_CORE_HW_END
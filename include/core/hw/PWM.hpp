@@ -9,7 +9,7 @@
 #include <core/hw/namespace.hpp>
 #include <core/hw/common.hpp>
 
-#include <functional>
+#include <core/hw/Delegate.hpp>
 
 #include "hal.h"
 
@@ -21,42 +21,63 @@ struct PWMDriverTraits {};
 #if STM32_PWM_USE_TIM1
 template <>
 struct PWMDriverTraits<1> {
-    static constexpr auto driver = &PWMD1;
+    static constexpr auto        driver   = &PWMD1;
+    static constexpr std::size_t CHANNELS = 4;
+    static constexpr bool        ADVANCED = true;
 };
 #endif
 
 #if STM32_PWM_USE_TIM2
 template <>
 struct PWMDriverTraits<2> {
-    static constexpr auto driver = &PWMD2;
+    static constexpr auto        driver   = &PWMD2;
+    static constexpr std::size_t CHANNELS = 4;
+    static constexpr bool        ADVANCED = false;
 };
 #endif
 
 #if STM32_PWM_USE_TIM3
 template <>
 struct PWMDriverTraits<3> {
-    static constexpr auto driver = &PWMD3;
+    static constexpr auto        driver   = &PWMD3;
+    static constexpr std::size_t CHANNELS = 4;
+    static constexpr bool        ADVANCED = false;
 };
 #endif
 
 #if STM32_PWM_USE_TIM4
 template <>
 struct PWMDriverTraits<4> {
-    static constexpr auto driver = &PWMD4;
+    static constexpr auto        driver   = &PWMD4;
+    static constexpr std::size_t CHANNELS = 4;
+    static constexpr bool        ADVANCED = false;
 };
 #endif
 
 #if STM32_PWM_USE_TIM5
 template <>
 struct PWMDriverTraits<5> {
-    static constexpr auto driver = &PWMD5;
+    static constexpr auto        driver   = &PWMD5;
+    static constexpr std::size_t CHANNELS = 4;
+    static constexpr bool        ADVANCED = false;
+};
+#endif
+
+#if STM32_PWM_USE_TIM8
+template <>
+struct PWMDriverTraits<8> {
+    static constexpr auto        driver   = &PWMD8;
+    static constexpr std::size_t CHANNELS = 4;
+    static constexpr bool        ADVANCED = true;
 };
 #endif
 
 #if STM32_PWM_USE_TIM15
 template <>
 struct PWMDriverTraits<15> {
-    static constexpr auto driver = &PWMD15;
+    static constexpr auto        driver   = &PWMD15;
+    static constexpr std::size_t CHANNELS = 2;
+    static constexpr bool        ADVANCED = false;
 };
 #endif
 
@@ -64,6 +85,7 @@ class PWMMaster
 {
 public:
     using Configuration = ::PWMConfig;
+    using Callback      = Delegate<void()>;
 
 public:
     virtual void
@@ -74,7 +96,7 @@ public:
     virtual void
     stop() = 0;
 
-    virtual void
+    virtual bool
     setFrequency(
         uint32_t frequency
     ) = 0;
@@ -93,7 +115,7 @@ public:
 
     virtual void
     setCallback(
-        std::function<void()>callback
+        Callback callback
     ) = 0;
 
     virtual void
@@ -104,6 +126,19 @@ public:
 
     virtual void
 	disableCallback() = 0;
+
+    virtual void
+    update(
+        const pwmcnt_t* values,
+        std::size_t     n
+    ) = 0;
+
+    virtual void
+    update(
+        const pwmcnt_t* values,
+        std::size_t     n,
+        pwmcnt_t        period
+    ) = 0;
 };
 
 
@@ -117,14 +152,26 @@ public:
     using CountDataType = pwmcnt_t;
 
 public:
-    static std::function<void()> callback_impl;
+    static Callback callback_impl;
 
+    /*! \brief Start the driver
+     *
+     * A callback installed with setCallback() is kept, and it overrides the
+     * one in the configuration.
+     */
     inline void
     start(
         const Configuration& config
     )
     {
-        ::pwmStart(PWM::driver, &config);
+        // Make a (non const) copy of the configuration, as we will change it at runtime
+        _configuration = config;
+
+        if (callback_impl) {
+            _configuration.callback = _callback;
+        }
+
+        ::pwmStart(PWM::driver, &_configuration);
     }
 
     inline void
@@ -133,53 +180,104 @@ public:
         ::pwmStop(PWM::driver);
     }
 
-    inline void
+    /*! \brief Change the counter frequency
+     *
+     * The prescaler is preloaded, so outputs keep running and the new
+     * frequency is applied at the next update event. The period is kept in
+     * ticks, so duty cycles are unchanged.
+     *
+     * \return false if the frequency is not an exact divider of the timer
+     * clock, in which case nothing is changed
+     */
+    inline bool
     setFrequency(
         uint32_t frequency
     )
     {
-        const_cast<Configuration*>(PWM::driver->config)->frequency = frequency;
+        if (frequency == 0) {
+            return false;
+        }
 
         if (PWM::driver->state == PWM_READY) {
-            stop();
-            ::pwmStart(PWM::driver, PWM::driver->config);
+            uint32_t psc = (PWM::driver->clock / frequency) - 1;
+
+            // A restart would not help, the HAL requires the same
+            if ((((psc + 1) * frequency) != PWM::driver->clock) || (psc > 0xFFFF)) {
+                return false;
+            }
+
+            PWM::driver->tim->PSC = psc;
         }
-    }
 
+        _configuration.frequency = frequency;
+
+        return true;
+    } // setFrequency
+
+    /*! \brief Change the period
+     *
+     * The new period and the compare values, rescaled to keep the same duty
+     * cycles, are applied together at the next update event.
+     */
     inline void
     setPeriod(
         CountDataType period
     )
     {
-        ::pwmChangePeriod(PWM::driver, period);
-    }
+        osalDbgCheck(period > 0);
+
+        _configuration.period = period;
+
+        if (PWM::driver->state == PWM_READY) {
+            stm32_tim_t*  tim = PWM::driver->tim;
+            CountDataType old;
+
+            chSysLock();
+            tim->CR1 |= STM32_TIM_CR1_UDIS;
+
+            old = PWM::driver->period;
+
+            for (std::size_t i = 0; i < PWM::CHANNELS; i++) {
+                // Rounded to the nearest tick, truncating would bias duty cycles down
+                tim->CCR[i] = static_cast<uint32_t>(((static_cast<uint64_t>(tim->CCR[i]) * period) + (old / 2)) / old);
+            }
+
+            PWM::driver->period = period;
+            tim->ARR = period - 1;
+
+            tim->CR1 &= ~STM32_TIM_CR1_UDIS;
+            chSysUnlock();
+        }
+    } // setPeriod
 
     inline uint32_t
     getFrequency()
     {
-        return PWM::driver->config->frequency;
+        return _configuration.frequency;
     }
 
     inline uint32_t
     getPeriod()
     {
-        return PWM::driver->config->period;
+        return (PWM::driver->state == PWM_READY) ? PWM::driver->period : _configuration.period;
     }
 
     inline void
     setCallback(
-        std::function<void()>callback
+        Callback callback
     )
     {
         callback_impl = callback;
 
-        const_cast<PWMConfig*>(PWM::driver->config)->callback = _callback;
+        _configuration.callback = _callback;
     }
 
     inline void
     resetCallback()
     {
-        const_cast<PWMConfig*>(PWM::driver->config)->callback = nullptr;
+        _configuration.callback = nullptr;
+
+        callback_impl = nullptr;
     }
 
     inline void
@@ -191,7 +289,66 @@ public:
 	disableCallback() {
         ::pwmDisablePeriodicNotification(PWM::driver);
     }
+
+    /*! \brief Update the first n channels in the same period
+     *
+     * Compare values are written to the preload registers with the update
+     * event disabled, so that they all become active at the first update
+     * event after the call.
+     */
+    inline void
+    update(
+        const CountDataType* values, //!< [in] compare values, from channel 0
+        std::size_t          n //!< [in] number of channels
+    )
+    {
+        _update(values, n, 0);
+    }
+
+    /*! \brief Update the first n channels and the period in the same period
+     *
+     */
+    inline void
+    update(
+        const CountDataType* values, //!< [in] compare values, from channel 0
+        std::size_t          n, //!< [in] number of channels
+        CountDataType        period //!< [in] new period, in ticks
+    )
+    {
+        _update(values, n, period);
+    }
+
 private:
+    static Configuration _configuration;
+
+    static inline void
+    _update(
+        const CountDataType* values,
+        std::size_t          n,
+        CountDataType        period
+    )
+    {
+        osalDbgCheck(n <= PWM::CHANNELS);
+
+        stm32_tim_t* tim = PWM::driver->tim;
+
+        chSysLock();
+        tim->CR1 |= STM32_TIM_CR1_UDIS;
+
+        for (std::size_t i = 0; i < n; i++) {
+            tim->CCR[i] = values[i];
+        }
+
+        if (period != 0) {
+            _configuration.period = period;
+            PWM::driver->period   = period;
+            tim->ARR = period - 1;
+        }
+
+        tim->CR1 &= ~STM32_TIM_CR1_UDIS;
+        chSysUnlock();
+    } // _update
+
     static inline void
     _callback(
         PWMDriver* pwmp
@@ -202,7 +359,10 @@ private:
 };
 
 template <class _PWM>
-std::function<void()>PWMMaster_<_PWM>::callback_impl;
+PWMMaster::Callback PWMMaster_<_PWM>::callback_impl;
+
+template <class _PWM>
+typename PWMMaster_<_PWM>::Configuration PWMMaster_<_PWM>::_configuration;
 
 
 class PWMChannel
@@ -272,10 +432,204 @@ public:
     inline uint32_t
     getPeriod()
     {
-        return PWM::driver->config->period;
+        return PWM::driver->period;
+    }
+};
+
+#ifndef CORE_HW_PWM_DMA_PRIORITY
+#define CORE_HW_PWM_DMA_PRIORITY 2
+#endif
+
+#ifndef CORE_HW_PWM_DMA_IRQ_PRIORITY
+#define CORE_HW_PWM_DMA_IRQ_PRIORITY 10
+#endif
+
+/*! \brief Multi channel PWM update through a timer DMA burst
+ *
+ * The new compare values (and optionally the period) are written through
+ * DMAR by a single DMA burst triggered by the next update event. The burst
+ * lands in the preload registers, so all the values become active together
+ * at the following update event, without any CPU work at the period
+ * boundary.
+ *
+ * \tparam _PWM PWMDriverTraits driver
+ * \tparam _DMA_STREAM DMA stream serving the timer UP request, as STM32_DMA_STREAM_ID()
+ * \tparam _DMA_CHANNEL DMA request channel (ignored on devices without request selection)
+ * \tparam _CHANNELS number of channels, from channel 0
+ */
+template <class _PWM, uint32_t _DMA_STREAM, uint32_t _DMA_CHANNEL = 0, std::size_t _CHANNELS = 4>
+class PWMBurst_
+{
+    static_assert(_CHANNELS > 0 && _CHANNELS <= _PWM::CHANNELS, "CHANNELS must be 1 .. the timer channels");
+
+public:
+    using PWM = _PWM;
+    using CountDataType = pwmcnt_t;
+
+public:
+    /*! \brief Allocate the DMA stream
+     *
+     * The PWM driver must have been started.
+     */
+    static void
+    start()
+    {
+        _errors = 0;
+
+        bool allocated = !dmaStreamAllocate(STM32_DMA_STREAM(_DMA_STREAM), CORE_HW_PWM_DMA_IRQ_PRIORITY, _serve, nullptr);
+
+        osalDbgAssert(allocated, "stream already allocated");
+        (void)allocated;
+
+        dmaStreamSetPeripheral(STM32_DMA_STREAM(_DMA_STREAM), &PWM::driver->tim->DMAR);
+        dmaStreamSetMemory0(STM32_DMA_STREAM(_DMA_STREAM), _buffer);
+    }
+
+    static void
+    stop()
+    {
+        chSysLock();
+        PWM::driver->tim->DIER &= ~STM32_TIM_DIER_UDE;
+        dmaStreamDisable(STM32_DMA_STREAM(_DMA_STREAM));
+        chSysUnlock();
+
+        dmaStreamRelease(STM32_DMA_STREAM(_DMA_STREAM));
+    }
+
+    /*! \brief Update all the channels at the next update event
+     *
+     * \return false if the previous update is still pending
+     */
+    static bool
+    update(
+        const CountDataType* values //!< [in] _CHANNELS compare values
+    )
+    {
+        return _arm(values, 0);
+    }
+
+    /*! \brief Update all the channels and the period at the next update event
+     *
+     * \return false if the previous update is still pending
+     */
+    static bool
+    update(
+        const CountDataType* values, //!< [in] _CHANNELS compare values
+        CountDataType        period //!< [in] new period, in ticks
+    )
+    {
+        return _arm(values, period);
+    }
+
+    /*! \brief Check if an update is waiting for the update event
+     *
+     */
+    static inline bool
+    isPending()
+    {
+        return (PWM::driver->tim->DIER & STM32_TIM_DIER_UDE) != 0;
+    }
+
+    /*! \brief Number of DMA transfer errors
+     *
+     */
+    static inline uint32_t
+    getErrors()
+    {
+        return _errors;
+    }
+
+private:
+    // ARR, RCR, CCR1 .. CCRn
+    static uint32_t _buffer[_CHANNELS + 2];
+    static uint32_t _errors;
+
+    static bool
+    _arm(
+        const CountDataType* values,
+        CountDataType        period
+    )
+    {
+        stm32_tim_t* tim = PWM::driver->tim;
+
+        chSysLock();
+
+        if (isPending()) {
+            chSysUnlock();
+            return false;
+        }
+
+        for (std::size_t i = 0; i < _CHANNELS; i++) {
+            _buffer[i + 2] = values[i];
+        }
+
+        if (period != 0) {
+            // Burst from ARR, RCR is written back unchanged
+            _buffer[0] = period - 1;
+            _buffer[1] = tim->RCR;
+            PWM::driver->period = period;
+
+            tim->DCR = STM32_TIM_DCR_DBA(11) | STM32_TIM_DCR_DBL(_CHANNELS + 1);
+            dmaStreamSetMemory0(STM32_DMA_STREAM(_DMA_STREAM), &_buffer[0]);
+            dmaStreamSetTransactionSize(STM32_DMA_STREAM(_DMA_STREAM), _CHANNELS + 2);
+        } else {
+            // Burst from CCR1
+            tim->DCR = STM32_TIM_DCR_DBA(13) | STM32_TIM_DCR_DBL(_CHANNELS - 1);
+            dmaStreamSetMemory0(STM32_DMA_STREAM(_DMA_STREAM), &_buffer[2]);
+            dmaStreamSetTransactionSize(STM32_DMA_STREAM(_DMA_STREAM), _CHANNELS);
+        }
+
+        dmaStreamSetMode(STM32_DMA_STREAM(_DMA_STREAM), _mode());
+        dmaStreamEnable(STM32_DMA_STREAM(_DMA_STREAM));
+
+        // The request is raised by the next update event only
+        tim->DIER |= STM32_TIM_DIER_UDE;
+
+        chSysUnlock();
+
+        return true;
+    } // _arm
+
+    static inline uint32_t
+    _mode()
+    {
+        uint32_t mode = STM32_DMA_CR_DIR_M2P | STM32_DMA_CR_PSIZE_WORD | STM32_DMA_CR_MSIZE_WORD | STM32_DMA_CR_MINC;
+
+        mode |= STM32_DMA_CR_TCIE | STM32_DMA_CR_TEIE | STM32_DMA_CR_PL(CORE_HW_PWM_DMA_PRIORITY);
+
+#if defined(STM32_DMA_CR_CHSEL)
+        mode |= STM32_DMA_CR_CHSEL(_DMA_CHANNEL);
+#endif
+
+        return mode;
+    }
+
+    static void
+    _serve(
+        void*    p,
+        uint32_t flags
+    )
+    {
+        (void)p;
+
+        if (flags & STM32_DMA_ISR_TEIF) {
+            _errors++;
+        }
+
+        chSysLockFromISR();
+        // Stop requesting until the next update is armed
+        PWM::driver->tim->DIER &= ~STM32_TIM_DIER_UDE;
+        dmaStreamDisable(STM32_DMA_STREAM(_DMA_STREAM));
+        chSysUnlockFromISR();
     }
 };
 
+template <class _PWM, uint32_t _DMA_STREAM, uint32_t _DMA_CHANNEL, std::size_t _CHANNELS>
+uint32_t PWMBurst_<_PWM, _DMA_STREAM, _DMA_CHANNEL, _CHANNELS>::_buffer[_CHANNELS + 2];
+
+template <class _PWM, uint32_t _DMA_STREAM, uint32_t _DMA_CHANNEL, std::size_t _CHANNELS>
+uint32_t PWMBurst_<_PWM, _DMA_STREAM, _DMA_CHANNEL, _CHANNELS>::_errors = 0;
+
 // --- Aliases -----------------------------------------------------------------
 
 using PWM_1 = PWMDriverTraits<1>;
@@ -283,6 +637,7 @@ using PWM_2 = PWMDriverTraits<2>;
 using PWM_3 = PWMDriverTraits<3>;
 using PWM_4 = PWMDriverTraits<4>;
 using PWM_5 = PWMDriverTraits<5>;
+using PWM_8 = PWMDriverTraits<8>;
 using PWM_15 = PWMDriverTraits<15>;
 
 NAMESPACE_CORE_HW_END
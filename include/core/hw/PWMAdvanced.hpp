@@ -0,0 +1,296 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/hw/namespace.hpp>
+#include <core/hw/common.hpp>
+
+#include <core/hw/Delegate.hpp>
+#include <core/hw/PWM.hpp>
+
+#include "hal.h"
+
+NAMESPACE_CORE_HW_BEGIN
+
+#ifndef CORE_HW_PWM_BREAK_IRQ_PRIORITY
+#define CORE_HW_PWM_BREAK_IRQ_PRIORITY 3
+#endif
+
+/*! \brief Dead time generator setting
+ *
+ * Converts a dead time in ns to the BDTR DTG encoding, at compile time.
+ * The dead time is rounded up to the next step available.
+ *
+ * \code
+ * config.bdtr = PWMDeadTime_<STM32_TIMCLK2, 500>::DTG;
+ * \endcode
+ *
+ * \tparam _CLOCK timer (dead time generator) clock, in Hz
+ * \tparam _NS dead time, in ns
+ */
+template <uint32_t _CLOCK, uint32_t _NS>
+struct PWMDeadTime_ {
+    static constexpr uint64_t TICKS = ((static_cast<uint64_t>(_NS) * _CLOCK) + 999999999) / 1000000000;
+
+    static_assert(TICKS <= 1008, "Dead time too long for the timer clock");
+
+    static constexpr uint32_t DTG = (TICKS <= 127) ? TICKS :
+                                    (TICKS <= 254) ? (0x80 | (((TICKS + 1) / 2) - 64)) :
+                                    (TICKS <= 504) ? (0xC0 | (((TICKS + 7) / 8) - 32)) :
+                                    (0xE0 | (((TICKS + 15) / 16) - 32));
+};
+
+/*! \brief PWM channel with complementary output
+ *
+ * The channel must be configured with one of the
+ * PWM_COMPLEMENTARY_OUTPUT_ modes, and the dead time set in the
+ * configuration bdtr field. Both outputs can also be switched on and off
+ * at runtime, e.g. for six step commutation.
+ */
+template <class _PWM, std::size_t _CHANNEL>
+class PWMComplementaryChannel_:
+    public PWMChannel_<_PWM, _CHANNEL>
+{
+    static_assert(_PWM::ADVANCED, "Complementary outputs are available on advanced timers only");
+    static_assert(_CHANNEL < 3, "Complementary outputs are available on channels 0 .. 2 only");
+
+public:
+    using PWM = _PWM;
+
+public:
+    /*! \brief Enable or disable the outputs
+     *
+     * Applied immediately, the compare value is not changed.
+     */
+    inline void
+    setOutputs(
+        bool main, //!< [in] main output enabled
+        bool complementary //!< [in] complementary output enabled
+    )
+    {
+        const uint32_t mask = (STM32_TIM_CCER_CC1E | STM32_TIM_CCER_CC1NE) << (4 * _CHANNEL);
+        uint32_t       bits = 0;
+
+        if (main) {
+            bits |= STM32_TIM_CCER_CC1E << (4 * _CHANNEL);
+        }
+
+        if (complementary) {
+            bits |= STM32_TIM_CCER_CC1NE << (4 * _CHANNEL);
+        }
+
+        chSysLock();
+        PWM::driver->tim->CCER = (PWM::driver->tim->CCER & ~mask) | bits;
+        chSysUnlock();
+    }
+};
+
+/*! \brief Break input handling
+ *
+ * When the break input becomes active, the timer hardware forces all the
+ * outputs to their idle state and clears MOE. The callback is then invoked
+ * from the break interrupt, which must be routed to serve() with
+ * CORE_HW_PWM_BREAK_IRQ_HANDLER(). Outputs stay off until rearm().
+ *
+ * \tparam _PWM PWMDriverTraits driver (advanced timer)
+ * \tparam _IRQ break interrupt number
+ */
+template <class _PWM, uint32_t _IRQ>
+class PWMBreak_
+{
+public:
+    using PWM      = _PWM;
+    using Callback = Delegate<void()>;
+
+    enum class Polarity {
+        LOW, //!< Active low
+        HIGH //!< Active high
+    };
+
+public:
+    /*! \brief Enable the break input
+     *
+     * The PWM driver must have been started.
+     */
+    static void
+    enable(
+        Polarity polarity,
+        Callback callback
+    )
+    {
+        stm32_tim_t* tim = PWM::driver->tim;
+
+        _callback_impl = callback;
+
+        chSysLock();
+        tim->BDTR &= ~(STM32_TIM_BDTR_BKE | STM32_TIM_BDTR_BKP | STM32_TIM_BDTR_AOE);
+        tim->BDTR |= STM32_TIM_BDTR_BKE | ((polarity == Polarity::HIGH) ? STM32_TIM_BDTR_BKP : 0);
+        tim->SR    = ~STM32_TIM_SR_BIF;
+        tim->DIER |= STM32_TIM_DIER_BIE;
+        chSysUnlock();
+
+        nvicEnableVector(_IRQ, CORE_HW_PWM_BREAK_IRQ_PRIORITY);
+    }
+
+    static void
+    disable()
+    {
+        stm32_tim_t* tim = PWM::driver->tim;
+
+        nvicDisableVector(_IRQ);
+
+        chSysLock();
+        tim->DIER &= ~STM32_TIM_DIER_BIE;
+        tim->BDTR &= ~STM32_TIM_BDTR_BKE;
+        chSysUnlock();
+
+        _callback_impl = nullptr;
+    }
+
+    /*! \brief Check if the outputs have been shut down by a break
+     *
+     */
+    static inline bool
+    isTripped()
+    {
+        return (PWM::driver->tim->BDTR & STM32_TIM_BDTR_MOE) == 0;
+    }
+
+    /*! \brief Enable the outputs again after a break
+     *
+     * Has no effect while the break input is still active.
+     */
+    static inline void
+    rearm()
+    {
+        stm32_tim_t* tim = PWM::driver->tim;
+
+        chSysLock();
+        tim->SR    = ~STM32_TIM_SR_BIF;
+        tim->BDTR |= STM32_TIM_BDTR_MOE;
+        tim->DIER |= STM32_TIM_DIER_BIE;
+        chSysUnlock();
+    }
+
+    /*! \brief Serve the break interrupt
+     *
+     */
+    static inline void
+    serve()
+    {
+        stm32_tim_t* tim = PWM::driver->tim;
+
+        if (tim->SR & STM32_TIM_SR_BIF) {
+            // The flag stays set while the input is active, mask it until rearm()
+            tim->DIER &= ~STM32_TIM_DIER_BIE;
+            _callback_impl();
+        }
+    }
+
+private:
+    static Callback _callback_impl;
+};
+
+template <class _PWM, uint32_t _IRQ>
+typename PWMBreak_<_PWM, _IRQ>::Callback PWMBreak_<_PWM, _IRQ>::_callback_impl;
+
+#define CORE_HW_PWM_BREAK_IRQ_HANDLER(VECTOR, BREAK) \
+    extern "C" { \
+    OSAL_IRQ_HANDLER(VECTOR) { \
+        OSAL_IRQ_PROLOGUE(); \
+        BREAK::serve(); \
+        OSAL_IRQ_EPILOGUE(); \
+    } \
+    }
+
+/*! \brief Slave timer of a PWMSync_ group
+ *
+ * \tparam _PWM PWMDriverTraits driver
+ * \tparam _TRIGGER internal trigger (ITRx) connected to the master timer
+ * \tparam _PHASE counter value when the master counter is 0, in ticks
+ */
+template <class _PWM, uint32_t _TRIGGER, pwmcnt_t _PHASE = 0>
+struct PWMSlave_ {
+    static_assert(_TRIGGER < 4, "TRIGGER must be 0 .. 3");
+
+    using PWM = _PWM;
+    static const uint32_t TRIGGER = _TRIGGER;
+    static const pwmcnt_t PHASE   = _PHASE;
+};
+
+/*! \brief Synchronized start of several PWM timers
+ *
+ * The master timer enable is routed to TRGO (MMS = enable), and the slave
+ * timers run in gated mode from it, so all the counters start and stop on
+ * the same timer clock. The master runs in master/slave mode (MSM), which
+ * delays its own counter by the trigger resynchronization, so each slave
+ * counter stays exactly at its phase.
+ *
+ * All the PWM drivers must have been started with the same timer clock,
+ * prescaler and period.
+ *
+ * \tparam _MASTER PWMDriverTraits master driver
+ * \tparam _SLAVES PWMSlave_ slave timers
+ */
+template <class _MASTER, class... _SLAVES>
+class PWMSync_
+{
+public:
+    using MASTER = _MASTER;
+
+public:
+    /*! \brief Start all the counters together
+     *
+     */
+    static void
+    start()
+    {
+        stm32_tim_t* tim = MASTER::driver->tim;
+
+        chSysLock();
+        tim->CR1 &= ~STM32_TIM_CR1_CEN;
+        tim->CNT  = 0;
+        tim->CR2  = (tim->CR2 & ~STM32_TIM_CR2_MMS_MASK) | STM32_TIM_CR2_MMS(1);
+        tim->SMCR |= STM32_TIM_SMCR_MSM;
+
+        int dummy[] = {
+            0, (_slave<_SLAVES>(), 0) ...
+        };
+        (void)dummy;
+
+        tim->CR1 |= STM32_TIM_CR1_CEN;
+        chSysUnlock();
+    }
+
+    /*! \brief Stop all the counters together
+     *
+     * Outputs hold their current level.
+     */
+    static void
+    stop()
+    {
+        chSysLock();
+        MASTER::driver->tim->CR1 &= ~STM32_TIM_CR1_CEN;
+        chSysUnlock();
+    }
+
+private:
+    template <class _SLAVE>
+    static inline void
+    _slave()
+    {
+        stm32_tim_t* tim = _SLAVE::PWM::driver->tim;
+
+        tim->CR1 &= ~STM32_TIM_CR1_CEN;
+        tim->CNT  = _SLAVE::PHASE;
+        tim->SMCR = (tim->SMCR & ~(STM32_TIM_SMCR_SMS_MASK | STM32_TIM_SMCR_TS_MASK)) | STM32_TIM_SMCR_TS(_SLAVE::TRIGGER) | STM32_TIM_SMCR_SMS(5);
+        // In gated mode, the counter runs while CEN is set and the trigger is high
+        tim->CR1 |= STM32_TIM_CR1_CEN;
+    }
+};
+
+NAMESPACE_CORE_HW_END
@@ -0,0 +1,272 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/hw/namespace.hpp>
+#include <core/hw/common.hpp>
+
+#include <core/hw/Delegate.hpp>
+#include <core/hw/PWM.hpp>
+
+#include "hal.h"
+
+NAMESPACE_CORE_HW_BEGIN
+
+/*! \brief Compare value streaming to a PWM channel
+ *
+ * Each update event triggers a DMA transfer of the next sample from a
+ * circular buffer to the channel compare register: the CPU is only
+ * involved when half of the buffer has to be refilled, or never when
+ * playing a constant table.
+ *
+ * The timer UP request is used, so a single stream (or PWMBurst_) per
+ * timer can be active. Samples are 16 bit wide.
+ *
+ * \tparam _PWM PWMDriverTraits driver
+ * \tparam _CHANNEL PWM channel (0 .. 3)
+ * \tparam _DMA_STREAM DMA stream serving the timer UP request, as STM32_DMA_STREAM_ID()
+ * \tparam _DMA_CHANNEL DMA request channel (ignored on devices without request selection)
+ * \tparam _SIZE number of samples in the circular buffer
+ */
+template <class _PWM, std::size_t _CHANNEL, uint32_t _DMA_STREAM, uint32_t _DMA_CHANNEL = 0, std::size_t _SIZE = 64>
+class PWMStream_
+{
+    static_assert(_CHANNEL < 4, "CHANNEL must be 0 .. 3");
+    static_assert((_SIZE >= 2) && ((_SIZE % 2) == 0), "Buffer size must be even");
+
+public:
+    using PWM    = _PWM;
+    using Sample = uint16_t;
+
+    /*! \brief Refill callback
+     *
+     * Invoked from ISR context with the half of the buffer that has just
+     * been transferred, and must fill it with _SIZE / 2 new samples.
+     */
+    using Callback = Delegate<void(Sample*, std::size_t)>;
+
+    static const std::size_t CHANNEL = _CHANNEL;
+    static const std::size_t SIZE    = _SIZE;
+
+public:
+    /*! \brief Start streaming from the refill callback
+     *
+     * The callback is invoked twice before starting, to fill the whole
+     * buffer. The PWM driver must have been started.
+     */
+    static void
+    start(
+        Callback callback
+    )
+    {
+        _callback_impl = callback;
+
+        _callback_impl(&_buffer[0], _SIZE / 2);
+        _callback_impl(&_buffer[_SIZE / 2], _SIZE / 2);
+
+        _start(_buffer, _SIZE, STM32_DMA_CR_HTIE | STM32_DMA_CR_TCIE);
+    }
+
+    /*! \brief Start playing a constant table
+     *
+     * The table is played in loop, with no interrupt at all.
+     */
+    static void
+    start(
+        const Sample* table, //!< [in] samples, e.g. a PWMWaveTable_
+        std::size_t   n //!< [in] number of samples
+    )
+    {
+        _callback_impl = nullptr;
+
+        _start(table, n, 0);
+    }
+
+    static void
+    stop()
+    {
+        chSysLock();
+        stopI();
+        chSysUnlock();
+
+        dmaStreamRelease(STM32_DMA_STREAM(_DMA_STREAM));
+    }
+
+    /*! \brief Stop the transfers
+     *
+     * Can be called from the refill callback. The stream must still be
+     * released by stop().
+     */
+    static inline void
+    stopI()
+    {
+        PWM::driver->tim->DIER &= ~STM32_TIM_DIER_UDE;
+        dmaStreamDisable(STM32_DMA_STREAM(_DMA_STREAM));
+    }
+
+    /*! \brief Number of DMA transfer errors
+     *
+     */
+    static inline uint32_t
+    getErrors()
+    {
+        return _errors;
+    }
+
+private:
+    static Callback _callback_impl;
+    static Sample   _buffer[_SIZE];
+    static uint32_t _errors;
+
+    static void
+    _start(
+        const Sample* samples,
+        std::size_t   n,
+        uint32_t      interrupts
+    )
+    {
+        _errors = 0;
+
+        bool allocated = !dmaStreamAllocate(STM32_DMA_STREAM(_DMA_STREAM), CORE_HW_PWM_DMA_IRQ_PRIORITY, _serve, nullptr);
+
+        osalDbgAssert(allocated, "stream already allocated");
+        (void)allocated;
+
+        uint32_t mode = STM32_DMA_CR_DIR_M2P | STM32_DMA_CR_PSIZE_HWORD | STM32_DMA_CR_MSIZE_HWORD | STM32_DMA_CR_MINC | STM32_DMA_CR_CIRC;
+
+        mode |= interrupts | STM32_DMA_CR_TEIE | STM32_DMA_CR_PL(CORE_HW_PWM_DMA_PRIORITY);
+
+#if defined(STM32_DMA_CR_CHSEL)
+        mode |= STM32_DMA_CR_CHSEL(_DMA_CHANNEL);
+#endif
+
+        dmaStreamSetPeripheral(STM32_DMA_STREAM(_DMA_STREAM), &PWM::driver->tim->CCR[_CHANNEL]);
+        dmaStreamSetMemory0(STM32_DMA_STREAM(_DMA_STREAM), samples);
+        dmaStreamSetTransactionSize(STM32_DMA_STREAM(_DMA_STREAM), n);
+        dmaStreamSetMode(STM32_DMA_STREAM(_DMA_STREAM), mode);
+        dmaStreamEnable(STM32_DMA_STREAM(_DMA_STREAM));
+
+        chSysLock();
+        PWM::driver->tim->DIER |= STM32_TIM_DIER_UDE;
+        chSysUnlock();
+    } // _start
+
+    static void
+    _serve(
+        void*    p,
+        uint32_t flags
+    )
+    {
+        (void)p;
+
+        if (flags & STM32_DMA_ISR_TEIF) {
+            _errors++;
+        }
+
+        if (flags & STM32_DMA_ISR_HTIF) {
+            _callback_impl(&_buffer[0], _SIZE / 2);
+        }
+
+        if (flags & STM32_DMA_ISR_TCIF) {
+            _callback_impl(&_buffer[_SIZE / 2], _SIZE / 2);
+        }
+    }
+};
+
+template <class _PWM, std::size_t _CHANNEL, uint32_t _DMA_STREAM, uint32_t _DMA_CHANNEL, std::size_t _SIZE>
+typename PWMStream_<_PWM, _CHANNEL, _DMA_STREAM, _DMA_CHANNEL, _SIZE>::Callback PWMStream_<_PWM, _CHANNEL, _DMA_STREAM, _DMA_CHANNEL, _SIZE>::_callback_impl;
+
+template <class _PWM, std::size_t _CHANNEL, uint32_t _DMA_STREAM, uint32_t _DMA_CHANNEL, std::size_t _SIZE>
+typename PWMStream_<_PWM, _CHANNEL, _DMA_STREAM, _DMA_CHANNEL, _SIZE>::Sample PWMStream_<_PWM, _CHANNEL, _DMA_STREAM, _DMA_CHANNEL, _SIZE>::_buffer[_SIZE];
+
+template <class _PWM, std::size_t _CHANNEL, uint32_t _DMA_STREAM, uint32_t _DMA_CHANNEL, std::size_t _SIZE>
+uint32_t PWMStream_<_PWM, _CHANNEL, _DMA_STREAM, _DMA_CHANNEL, _SIZE>::_errors = 0;
+
+// --- Wave tables -------------------------------------------------------------
+
+template <std::size_t... _I>
+struct PWMWaveIndices_ {};
+
+template <std::size_t _N, std::size_t... _I>
+struct PWMWaveSequence_:
+    PWMWaveSequence_<_N - 1, _N - 1, _I...>
+{};
+
+template <std::size_t... _I>
+struct PWMWaveSequence_<0, _I...>{
+    using type = PWMWaveIndices_<_I...>;
+};
+
+/*! \brief Compile time generated wave table
+ *
+ * The table is computed by the compiler and stored in flash.
+ *
+ * \tparam _GENERATOR class with a constexpr static value(index, size) member
+ * \tparam _SIZE number of samples
+ */
+template <class _GENERATOR, std::size_t _SIZE, class _INDICES = typename PWMWaveSequence_<_SIZE>::type>
+struct PWMWaveTable_;
+
+template <class _GENERATOR, std::size_t _SIZE, std::size_t... _I>
+struct PWMWaveTable_<_GENERATOR, _SIZE, PWMWaveIndices_<_I...> >{
+    static const std::size_t SIZE = _SIZE;
+    static constexpr uint16_t values[_SIZE] = {
+        _GENERATOR::value(_I, _SIZE) ...
+    };
+};
+
+template <class _GENERATOR, std::size_t _SIZE, std::size_t... _I>
+constexpr uint16_t PWMWaveTable_<_GENERATOR, _SIZE, PWMWaveIndices_<_I...> >::values[_SIZE];
+
+/*! \brief Sine wave generator
+ *
+ * Samples one period of offset + amplitude * sin(x), rounded to the
+ * nearest tick.
+ *
+ * \tparam _OFFSET mid scale compare value, in ticks
+ * \tparam _AMPLITUDE peak amplitude, in ticks
+ */
+template <uint16_t _OFFSET, uint16_t _AMPLITUDE>
+struct PWMSine_ {
+    static_assert(_AMPLITUDE <= _OFFSET, "AMPLITUDE must not exceed OFFSET");
+    static_assert(_OFFSET + _AMPLITUDE <= 0xFFFF, "Samples must fit 16 bits");
+
+    static constexpr uint16_t
+    value(
+        std::size_t index,
+        std::size_t size
+    )
+    {
+        // sin(x) = -sin(x - pi), with x - pi in [-pi, pi)
+        return static_cast<uint16_t>(_OFFSET - _AMPLITUDE * _sin(2.0 * PI * index / size - PI) + 0.5);
+    }
+
+private:
+    static constexpr double PI = 3.14159265358979323846;
+
+    // Taylor series, accurate to 1e-7 in [-pi, pi]
+    static constexpr double
+    _series(
+        double x2,
+        double term,
+        int    n,
+        int    k
+    )
+    {
+        return (k == 0) ? term : term + _series(x2, -term * x2 / ((n + 1) * (n + 2)), n + 2, k - 1);
+    }
+
+    static constexpr double
+    _sin(
+        double x
+    )
+    {
+        return _series(x * x, x, 1, 10);
+    }
+};
+
+NAMESPACE_CORE_HW_END
@@ -0,0 +1,390 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/hw/namespace.hpp>
+#include <core/hw/common.hpp>
+
+#include <core/hw/TIMCAP.hpp>
+#include <core/hw/Snapshot.hpp>
+
+#include <type_traits>
+
+#include "hal.h"
+#include "hal_timcap.h"
+
+NAMESPACE_CORE_HW_BEGIN
+
+#ifndef CORE_HW_RC_MIN_PULSE
+#define CORE_HW_RC_MIN_PULSE 500
+#endif
+
+#ifndef CORE_HW_RC_MAX_PULSE
+#define CORE_HW_RC_MAX_PULSE 2500
+#endif
+
+#ifndef CORE_HW_RC_PPM_SYNC
+#define CORE_HW_RC_PPM_SYNC 3000
+#endif
+
+/*! \brief Decoded RC frame
+ *
+ * \tparam _CHANNELS maximum number of channels
+ */
+template <std::size_t _CHANNELS>
+struct RCFrame_ {
+    static const std::size_t CHANNELS = _CHANNELS;
+
+    uint16_t  channels[_CHANNELS]; //!< Pulse widths, in timer ticks
+    uint8_t   count; //!< Number of decoded channels
+    systime_t time; //!< Reception time
+};
+
+/*! \brief RC pulse timing
+ *
+ */
+struct RCTiming {
+    /*! \brief Convert a time to capture timer ticks
+     *
+     * Pulses are measured with the 16 bit counter, the result must fit it.
+     */
+    static inline uint16_t
+    ticks(
+        uint32_t frequency, //!< [in] counter frequency, in Hz
+        uint32_t us //!< [in] time, in us
+    )
+    {
+        uint64_t ticks = (static_cast<uint64_t>(frequency) * us) / 1000000;
+
+        CORE_ASSERT(ticks <= 0xFFFF);
+
+        return static_cast<uint16_t>(ticks);
+    }
+};
+
+/*! \brief PWM input decoder
+ *
+ * Decodes up to 4 PWM inputs on the channels of a single capture timer.
+ * Each channel captures its rising edge, then its falling edge, swapping
+ * the capture polarity in the ISR. A frame is published once every
+ * channel has been updated.
+ *
+ * Pulses shorter than CORE_HW_RC_MIN_PULSE or longer than
+ * CORE_HW_RC_MAX_PULSE (in us) are discarded.
+ *
+ * \tparam _TIMCAP TIMCAPDriverTraits driver
+ * \tparam _CHANNELS number of inputs, from timer channel 0
+ */
+template <class _TIMCAP, std::size_t _CHANNELS = 4>
+class RCPWMDecoder_
+{
+    static_assert(_CHANNELS > 0 && _CHANNELS <= 4, "CHANNELS must be 1 .. 4");
+
+public:
+    using TIMCAP = _TIMCAP;
+    using Frame  = RCFrame_<_CHANNELS>;
+
+public:
+    /*! \brief Start decoding
+     *
+     * CORE_HW_RC_MAX_PULSE must fit the 16 bit counter at the given
+     * frequency.
+     */
+    static void
+    start(
+        uint32_t frequency = 1000000 //!< [in] timer frequency
+    )
+    {
+        TIMCAPConfig config = {};
+
+        config.frequency = frequency;
+
+        for (std::size_t i = 0; i < _CHANNELS; i++) {
+            config.modes[i] = TIMCAP_INPUT_ACTIVE_HIGH;
+        }
+
+        _install<_CHANNELS - 1>(config);
+
+        _min     = RCTiming::ticks(frequency, CORE_HW_RC_MIN_PULSE);
+        _max     = RCTiming::ticks(frequency, CORE_HW_RC_MAX_PULSE);
+        _updated = 0;
+
+        _master.start(config);
+        _master.enable();
+    }
+
+    static void
+    stop()
+    {
+        _master.disable();
+        _master.stop();
+    }
+
+    /*! \brief Get the last frame
+     *
+     * \return false if no frame has been decoded yet
+     */
+    static bool
+    get(
+        Frame& frame
+    )
+    {
+        _snapshot.read(frame);
+
+        return _snapshot.version() > 0;
+    }
+
+private:
+    static const uint32_t ALL = (1U << _CHANNELS) - 1;
+
+    static TIMCAPMaster_<_TIMCAP> _master;
+    static Snapshot_<Frame>       _snapshot;
+    static Frame    _frame;
+    static uint16_t _rise[_CHANNELS];
+    static uint16_t _min;
+    static uint16_t _max;
+    static uint32_t _updated;
+
+    template <std::size_t _CHANNEL>
+    static inline typename std::enable_if<_CHANNEL == 0>::type
+    _install(
+        TIMCAPConfig& config
+    )
+    {
+        config.capture_cb_array[0] = _capture<0>;
+    }
+
+    template <std::size_t _CHANNEL>
+    static inline typename std::enable_if<(_CHANNEL > 0)>::type
+    _install(
+        TIMCAPConfig& config
+    )
+    {
+        config.capture_cb_array[_CHANNEL] = _capture<_CHANNEL>;
+        _install<_CHANNEL - 1>(config);
+    }
+
+    template <std::size_t _CHANNEL>
+    static void
+    _capture(
+        TIMCAPDriver* timcapp
+    )
+    {
+        const uint32_t polarity = STM32_TIM_CCER_CC1P << (4 * _CHANNEL);
+
+        stm32_tim_t* tim = timcapp->tim;
+        uint16_t     ccr = timcap_lld_get_ccr(timcapp, _CHANNEL);
+
+        if ((tim->CCER & polarity) == 0) {
+            // Rising edge, wait for the falling one
+            _rise[_CHANNEL] = ccr;
+            tim->CCER      |= polarity;
+            return;
+        }
+
+        tim->CCER &= ~polarity;
+
+        uint16_t width = ccr - _rise[_CHANNEL];
+
+        if ((width < _min) || (width > _max)) {
+            return;
+        }
+
+        _frame.channels[_CHANNEL] = width;
+        _updated |= (1U << _CHANNEL);
+
+        if (_updated == ALL) {
+            _frame.count = _CHANNELS;
+            _frame.time  = chVTGetSystemTimeX();
+            _snapshot.publish(_frame);
+            _updated = 0;
+        }
+    } // _capture
+};
+
+template <class _TIMCAP, std::size_t _CHANNELS>
+TIMCAPMaster_<_TIMCAP> RCPWMDecoder_<_TIMCAP, _CHANNELS>::_master;
+
+template <class _TIMCAP, std::size_t _CHANNELS>
+Snapshot_<typename RCPWMDecoder_<_TIMCAP, _CHANNELS>::Frame> RCPWMDecoder_<_TIMCAP, _CHANNELS>::_snapshot;
+
+template <class _TIMCAP, std::size_t _CHANNELS>
+typename RCPWMDecoder_<_TIMCAP, _CHANNELS>::Frame RCPWMDecoder_<_TIMCAP, _CHANNELS>::_frame;
+
+template <class _TIMCAP, std::size_t _CHANNELS>
+uint16_t RCPWMDecoder_<_TIMCAP, _CHANNELS>::_rise[_CHANNELS];
+
+template <class _TIMCAP, std::size_t _CHANNELS>
+uint16_t RCPWMDecoder_<_TIMCAP, _CHANNELS>::_min = 0;
+
+template <class _TIMCAP, std::size_t _CHANNELS>
+uint16_t RCPWMDecoder_<_TIMCAP, _CHANNELS>::_max = 0;
+
+template <class _TIMCAP, std::size_t _CHANNELS>
+uint32_t RCPWMDecoder_<_TIMCAP, _CHANNELS>::_updated = 0;
+
+/*! \brief PPM decoder
+ *
+ * Decodes a PPM stream on a single capture channel, from the time between
+ * consecutive active edges. A gap longer than CORE_HW_RC_PPM_SYNC (in us),
+ * or a silent line, marks the start of a frame; the frame decoded so far
+ * is published if all its pulses were valid.
+ *
+ * \tparam _TIMCAP TIMCAPDriverTraits driver
+ * \tparam _CHANNEL timer channel (0 .. 3)
+ * \tparam _MAX_CHANNELS maximum number of channels in a frame
+ */
+template <class _TIMCAP, std::size_t _CHANNEL, std::size_t _MAX_CHANNELS = 8>
+class RCPPMDecoder_
+{
+    static_assert(_CHANNEL < 4, "CHANNEL must be 0 .. 3");
+
+public:
+    using TIMCAP = _TIMCAP;
+    using Frame  = RCFrame_<_MAX_CHANNELS>;
+
+public:
+    /*! \brief Start decoding
+     *
+     * CORE_HW_RC_PPM_SYNC must fit the 16 bit counter at the given
+     * frequency.
+     */
+    static void
+    start(
+        uint32_t frequency = 1000000, //!< [in] timer frequency
+        bool     inverted = false //!< [in] active edge is the falling one
+    )
+    {
+        TIMCAPConfig config = {};
+
+        config.frequency                  = frequency;
+        config.modes[_CHANNEL]            = inverted ? TIMCAP_INPUT_ACTIVE_LOW : TIMCAP_INPUT_ACTIVE_HIGH;
+        config.capture_cb_array[_CHANNEL] = _capture;
+        config.overflow_cb                = _overflow;
+
+        _min       = RCTiming::ticks(frequency, CORE_HW_RC_MIN_PULSE);
+        _max       = RCTiming::ticks(frequency, CORE_HW_RC_MAX_PULSE);
+        _sync      = RCTiming::ticks(frequency, CORE_HW_RC_PPM_SYNC);
+        _index     = 0;
+        _valid     = false;
+        _overflows = 2;
+
+        _master.start(config);
+        _master.enable();
+    }
+
+    static void
+    stop()
+    {
+        _master.disable();
+        _master.stop();
+    }
+
+    /*! \brief Get the last frame
+     *
+     * \return false if no frame has been decoded yet
+     */
+    static bool
+    get(
+        Frame& frame
+    )
+    {
+        _snapshot.read(frame);
+
+        return _snapshot.version() > 0;
+    }
+
+private:
+    static TIMCAPMaster_<_TIMCAP> _master;
+    static Snapshot_<Frame>       _snapshot;
+    static Frame       _frame;
+    static uint16_t    _last;
+    static uint16_t    _min;
+    static uint16_t    _max;
+    static uint16_t    _sync;
+    static std::size_t _index;
+    static bool        _valid;
+    static uint32_t    _overflows;
+
+    static void
+    _overflow(
+        TIMCAPDriver* timcapp
+    )
+    {
+        (void)timcapp;
+
+        _overflows++;
+    }
+
+    static void
+    _capture(
+        TIMCAPDriver* timcapp
+    )
+    {
+        uint16_t ccr   = timcap_lld_get_ccr(timcapp, _CHANNEL);
+        uint16_t delta = ccr - _last;
+        bool     gap   = (_overflows >= 2) || (delta >= _sync);
+
+        _last      = ccr;
+        _overflows = 0;
+
+        if (gap) {
+            if (_valid && (_index > 0)) {
+                _frame.count = static_cast<uint8_t>(_index);
+                _frame.time  = chVTGetSystemTimeX();
+                _snapshot.publish(_frame);
+            }
+
+            _index = 0;
+            _valid = true;
+            return;
+        }
+
+        if (!_valid) {
+            return; // Wait for the next sync
+        }
+
+        if ((delta < _min) || (delta > _max) || (_index >= _MAX_CHANNELS)) {
+            _valid = false;
+            return;
+        }
+
+        _frame.channels[_index++] = delta;
+    } // _capture
+};
+
+template <class _TIMCAP, std::size_t _CHANNEL, std::size_t _MAX_CHANNELS>
+TIMCAPMaster_<_TIMCAP> RCPPMDecoder_<_TIMCAP, _CHANNEL, _MAX_CHANNELS>::_master;
+
+template <class _TIMCAP, std::size_t _CHANNEL, std::size_t _MAX_CHANNELS>
+Snapshot_<typename RCPPMDecoder_<_TIMCAP, _CHANNEL, _MAX_CHANNELS>::Frame> RCPPMDecoder_<_TIMCAP, _CHANNEL, _MAX_CHANNELS>::_snapshot;
+
+template <class _TIMCAP, std::size_t _CHANNEL, std::size_t _MAX_CHANNELS>
+typename RCPPMDecoder_<_TIMCAP, _CHANNEL, _MAX_CHANNELS>::Frame RCPPMDecoder_<_TIMCAP, _CHANNEL, _MAX_CHANNELS>::_frame;
+
+template <class _TIMCAP, std::size_t _CHANNEL, std::size_t _MAX_CHANNELS>
+uint16_t RCPPMDecoder_<_TIMCAP, _CHANNEL, _MAX_CHANNELS>::_last = 0;
+
+template <class _TIMCAP, std::size_t _CHANNEL, std::size_t _MAX_CHANNELS>
+uint16_t RCPPMDecoder_<_TIMCAP, _CHANNEL, _MAX_CHANNELS>::_min = 0;
+
+template <class _TIMCAP, std::size_t _CHANNEL, std::size_t _MAX_CHANNELS>
+uint16_t RCPPMDecoder_<_TIMCAP, _CHANNEL, _MAX_CHANNELS>::_max = 0;
+
+template <class _TIMCAP, std::size_t _CHANNEL, std::size_t _MAX_CHANNELS>
+uint16_t RCPPMDecoder_<_TIMCAP, _CHANNEL, _MAX_CHANNELS>::_sync = 0;
+
+template <class _TIMCAP, std::size_t _CHANNEL, std::size_t _MAX_CHANNELS>
+std::size_t RCPPMDecoder_<_TIMCAP, _CHANNEL, _MAX_CHANNELS>::_index = 0;
+
+template <class _TIMCAP, std::size_t _CHANNEL, std::size_t _MAX_CHANNELS>
+bool RCPPMDecoder_<_TIMCAP, _CHANNEL, _MAX_CHANNELS>::_valid = false;
+
+template <class _TIMCAP, std::size_t _CHANNEL, std::size_t _MAX_CHANNELS>
+uint32_t RCPPMDecoder_<_TIMCAP, _CHANNEL, _MAX_CHANNELS>::_overflows = 0;
+
+NAMESPACE_CORE_HW_END
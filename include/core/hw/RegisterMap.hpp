@@ -0,0 +1,223 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/hw/namespace.hpp>
+#include <core/hw/common.hpp>
+
+#include <cstdint>
+#include <type_traits>
+
+NAMESPACE_CORE_HW_BEGIN
+
+/*! \brief Register access
+ *
+ */
+enum class RegisterAccess {
+    READ_ONLY, //!< Read only
+    WRITE_ONLY, //!< Write only
+    READ_WRITE //!< Read and write
+};
+
+/*! \brief Register flags
+ *
+ */
+struct RegisterFlags {
+    enum : uint8_t {
+        NONE      = 0x00, //!< Little endian, can be part of a read burst
+        NO_BURST  = 0x01, //!< Must be read on its own (e.g. FIFOs, clear on read)
+        MSB_FIRST = 0x02, //!< Multi byte values are transferred MSB first
+        VOLATILE  = 0x04 //!< Value changed by the device, never cached
+    };
+};
+
+/*! \brief Device register description
+ *
+ * \tparam _ADDRESS register address
+ * \tparam _TYPE register value type
+ * \tparam _ACCESS register access
+ * \tparam _FLAGS RegisterFlags
+ */
+template <uint8_t _ADDRESS, typename _TYPE = uint8_t, RegisterAccess _ACCESS = RegisterAccess::READ_WRITE, uint8_t _FLAGS = RegisterFlags::NONE>
+struct Register_ {
+    static_assert(std::is_integral<_TYPE>::value && !std::is_same<_TYPE, bool>::value, "Register type must be an integer");
+
+    using Type = _TYPE;
+
+    static constexpr uint8_t        ADDRESS   = _ADDRESS;
+    static constexpr std::size_t    SIZE      = sizeof(Type);
+    static constexpr RegisterAccess ACCESS    = _ACCESS;
+    static constexpr bool           BURST     = (_FLAGS & RegisterFlags::NO_BURST) == 0;
+    static constexpr bool           MSB_FIRST = (_FLAGS & RegisterFlags::MSB_FIRST) != 0;
+    static constexpr bool           VOLATILE  = (_FLAGS & RegisterFlags::VOLATILE) != 0;
+
+    static inline Type
+    decode(
+        const uint8_t* raw
+    )
+    {
+        using Unsigned = typename std::make_unsigned<Type>::type;
+
+        Unsigned value = 0;
+
+        for (std::size_t i = 0; i < SIZE; i++) {
+            value |= static_cast<Unsigned>(raw[i]) << (8 * (MSB_FIRST ? (SIZE - 1 - i) : i));
+        }
+
+        return static_cast<Type>(value);
+    }
+
+    static inline void
+    encode(
+        Type     value,
+        uint8_t* raw
+    )
+    {
+        using Unsigned = typename std::make_unsigned<Type>::type;
+
+        Unsigned tmp = static_cast<Unsigned>(value);
+
+        for (std::size_t i = 0; i < SIZE; i++) {
+            raw[i] = static_cast<uint8_t>(tmp >> (8 * (MSB_FIRST ? (SIZE - 1 - i) : i)));
+        }
+    }
+};
+
+/*! \brief Typed register accessors over a bus transport
+ *
+ * The transport must provide:
+ * - static bool read(uint8_t address, void* data, std::size_t n)
+ * - static bool write(uint8_t address, const void* data, std::size_t n)
+ *
+ * Reads of more than one register are coalesced: registers listed in
+ * ascending address order that are contiguous and burst capable are fetched
+ * with a single bus transaction.
+ *
+ * \tparam _TRANSPORT bus transport (e.g. SPIRegisterTransport_, I2CRegisterTransport_)
+ * \tparam _MAX_BURST maximum number of bytes read at once
+ */
+template <class _TRANSPORT, std::size_t _MAX_BURST = 32>
+class RegisterMap_
+{
+public:
+    using Transport = _TRANSPORT;
+
+    /*! \brief Read one or more registers
+     *
+     * \return true on success
+     */
+    template <class... _REGISTERS>
+    static bool
+    read(
+        typename _REGISTERS::Type&... values //!< [out] register values
+    )
+    {
+        static_assert(sizeof...(_REGISTERS) > 0, "No registers to read");
+        static_assert(_Readable<_REGISTERS...>::value, "Register is write only");
+        static_assert(_Size<_REGISTERS...>::value <= _MAX_BURST, "Registers exceed the maximum burst size");
+
+        static const uint8_t address[] = {
+            _REGISTERS::ADDRESS ...
+        };
+        static const uint8_t size[] = {
+            _REGISTERS::SIZE ...
+        };
+        static const bool burst[] = {
+            _REGISTERS::BURST ...
+        };
+        static const Decoder decoder[] = {
+            &_decode<_REGISTERS>...
+        };
+        void* const destination[] = {
+            &values ...
+        };
+
+        const std::size_t N = sizeof...(_REGISTERS);
+        uint8_t raw[_Size<_REGISTERS...>::value];
+
+        std::size_t first = 0;
+
+        while (first < N) {
+            std::size_t last = first;
+            std::size_t n    = size[first];
+
+            while ((last + 1 < N) && burst[last] && burst[last + 1] && (address[last + 1] == address[last] + size[last])) {
+                last++;
+                n += size[last];
+            }
+
+            if (!Transport::read(address[first], raw, n)) {
+                return false;
+            }
+
+            const uint8_t* p = raw;
+
+            for (std::size_t i = first; i <= last; i++) {
+                decoder[i](p, destination[i]);
+                p += size[i];
+            }
+
+            first = last + 1;
+        }
+
+        return true;
+    } // read
+
+    /*! \brief Write a register
+     *
+     * \return true on success
+     */
+    template <class _REGISTER>
+    static bool
+    write(
+        typename _REGISTER::Type value //!< [in] register value
+    )
+    {
+        static_assert(_REGISTER::ACCESS != RegisterAccess::READ_ONLY, "Register is read only");
+
+        uint8_t raw[_REGISTER::SIZE];
+
+        _REGISTER::encode(value, raw);
+
+        return Transport::write(_REGISTER::ADDRESS, raw, _REGISTER::SIZE);
+    }
+
+private:
+    using Decoder = void (*)(const uint8_t*, void*);
+
+    template <class _REGISTER>
+    static void
+    _decode(
+        const uint8_t* raw,
+        void*          value
+    )
+    {
+        *static_cast<typename _REGISTER::Type*>(value) = _REGISTER::decode(raw);
+    }
+
+    template <class... _REGISTERS>
+    struct _Size {
+        static constexpr std::size_t value = 0;
+    };
+
+    template <class _HEAD, class... _TAIL>
+    struct _Size<_HEAD, _TAIL...> {
+        static constexpr std::size_t value = _HEAD::SIZE + _Size<_TAIL...>::value;
+    };
+
+    template <class... _REGISTERS>
+    struct _Readable {
+        static constexpr bool value = true;
+    };
+
+    template <class _HEAD, class... _TAIL>
+    struct _Readable<_HEAD, _TAIL...> {
+        static constexpr bool value = (_HEAD::ACCESS != RegisterAccess::WRITE_ONLY) && _Readable<_TAIL...>::value;
+    };
+};
+
+NAMESPACE_CORE_HW_END
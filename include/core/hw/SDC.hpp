@@ -9,7 +9,7 @@
 #include <core/hw/namespace.hpp>
 #include <core/hw/common.hpp>
 
-#include <functional>
+#include <core/hw/Delegate.hpp>
 
 #include "hal.h"
 
@@ -36,7 +36,7 @@ struct SDCDriverTraits<1> {
 class SDC
 {
 public:
-    using Callback = std::function<bool(void)>;
+    using Callback = Delegate<bool(void)>;
 };
 
 template <class _SDC>
@@ -75,15 +75,7 @@ public:
 
     void
     setInsertCallback(
-        Callback&& callback
-    )
-    {
-        _insert_callback_impl = std::move(callback);
-    }
-
-    void
-    setInsertCallback(
-    	Callback& callback
+        Callback callback
     )
     {
         _insert_callback_impl = callback;
@@ -91,15 +83,7 @@ public:
 
     void
     setRemoveCallback(
-        Callback&& callback
-    )
-    {
-        _remove_callback_impl = std::move(callback);
-    }
-
-    void
-    setRemoveCallback(
-        Callback& callback
+        Callback callback
     )
     {
         _remove_callback_impl = callback;
@@ -8,7 +8,7 @@
 
 #include <core/hw/namespace.hpp>
 #include <core/hw/common.hpp>
-#include <functional>
+#include <core/hw/Delegate.hpp>
 #include <type_traits>
 
 #include "hal.h"
@@ -40,7 +40,7 @@ struct SDUDriverTraits<1> {
 class USBDescriptors
 {
 public:
-    using GetDescriptorsCallback = std::function<const USBDescriptor*(USBDriver*, uint8_t, uint8_t, uint16_t)>;
+    using GetDescriptorsCallback = Delegate<const USBDescriptor*(USBDriver*, uint8_t, uint8_t, uint16_t)>;
 
     virtual const USBDescriptor*
     get_descriptor(
@@ -287,16 +287,17 @@ public:
     GetDescriptorsCallback
     callback()
     {
-        return std::bind(&SDUDefaultDescriptors::get_descriptor, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4);
+        return [this](USBDriver* usbp, uint8_t dtype, uint8_t dindex, uint16_t lang) {
+            return get_descriptor(usbp, dtype, dindex, lang);
+        };
     }
 
     static GetDescriptorsCallback
     static_callback()
     {
         static SDUDefaultDescriptors _descriptor;
-        static auto _callback = std::bind(&SDUDefaultDescriptors::get_descriptor, &_descriptor, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4);
 
-        return _callback;
+        return _descriptor.callback();
     }
 };
 
@@ -6,15 +6,21 @@
 
 #pragma once
 
-//TODO: hal
-
 #include <core/hw/namespace.hpp>
 #include <core/hw/common.hpp>
 
 #include <core/hw/GPIO.hpp>
+#include <core/hw/RegisterMap.hpp>
+#include <core/hw/Delegate.hpp>
+
+#include "hal.h"
 
 NAMESPACE_CORE_HW_BEGIN
 
+#ifndef CORE_HW_SPI_USE_STATISTICS
+#define CORE_HW_SPI_USE_STATISTICS FALSE
+#endif
+
 template <std::size_t S>
 struct SPIDriverTraits {};
 
@@ -22,6 +28,12 @@ struct SPIDriverTraits {};
 template <>
 struct SPIDriverTraits<1> {
     static constexpr auto driver = &SPID1;
+
+    static inline void
+    reset()
+    {
+        rccResetSPI1();
+    }
 };
 #endif
 
@@ -29,6 +41,12 @@ struct SPIDriverTraits<1> {
 template <>
 struct SPIDriverTraits<2> {
     static constexpr auto driver = &SPID2;
+
+    static inline void
+    reset()
+    {
+        rccResetSPI2();
+    }
 };
 #endif
 
@@ -36,8 +54,128 @@ struct SPIDriverTraits<2> {
 template <>
 struct SPIDriverTraits<3> {
     static constexpr auto driver = &SPID3;
+
+    static inline void
+    reset()
+    {
+        rccResetSPI3();
+    }
+};
+#endif
+
+/*! \brief SPI bus usage statistics
+ *
+ * Times are expressed in realtime counter cycles.
+ */
+struct SPIStatistics {
+    uint32_t transactions; //!< Number of transfers
+    uint32_t bytes; //!< Number of bytes transferred
+    uint32_t acquisitions; //!< Number of bus acquisitions
+    uint64_t wait_time; //!< Total time spent waiting for the bus
+    uint64_t hold_time; //!< Total time the bus has been held
+    uint32_t max_wait_time; //!< Longest wait for the bus
+    uint32_t max_hold_time; //!< Longest bus hold
 };
+
+/*! \brief SPI statistics recorder
+ *
+ * All the methods are empty when CORE_HW_SPI_USE_STATISTICS is disabled.
+ */
+class SPIStatisticsRecorder
+{
+public:
+    static inline rtcnt_t
+    now()
+    {
+#if CORE_HW_SPI_USE_STATISTICS
+        return chSysGetRealtimeCounterX();
+#else
+        return 0;
 #endif
+    }
+
+    inline void
+    acquired(
+        rtcnt_t request //!< [in] time at which the bus has been requested
+    )
+    {
+#if CORE_HW_SPI_USE_STATISTICS
+        rtcnt_t  t    = now();
+        uint32_t wait = t - request;
+
+        chSysLock();
+        _statistics.acquisitions++;
+        _statistics.wait_time += wait;
+
+        if (wait > _statistics.max_wait_time) {
+            _statistics.max_wait_time = wait;
+        }
+
+        _acquired = t;
+        chSysUnlock();
+#else
+        (void)request;
+#endif
+    }
+
+    inline void
+    released()
+    {
+#if CORE_HW_SPI_USE_STATISTICS
+        uint32_t hold = now() - _acquired;
+
+        chSysLock();
+        _statistics.hold_time += hold;
+
+        if (hold > _statistics.max_hold_time) {
+            _statistics.max_hold_time = hold;
+        }
+
+        chSysUnlock();
+#endif
+    }
+
+    inline void
+    transferred(
+        std::size_t n //!< [in] number of bytes
+    )
+    {
+#if CORE_HW_SPI_USE_STATISTICS
+        chSysLock();
+        _statistics.transactions++;
+        _statistics.bytes += n;
+        chSysUnlock();
+#else
+        (void)n;
+#endif
+    }
+
+#if CORE_HW_SPI_USE_STATISTICS
+    inline SPIStatistics
+    get()
+    {
+        SPIStatistics tmp;
+
+        chSysLock();
+        tmp = _statistics;
+        chSysUnlock();
+
+        return tmp;
+    }
+
+    inline void
+    reset()
+    {
+        chSysLock();
+        _statistics = SPIStatistics();
+        chSysUnlock();
+    }
+
+private:
+    SPIStatistics _statistics = SPIStatistics();
+    rtcnt_t       _acquired   = 0;
+#endif
+};
 
 class SPIMaster
 {
@@ -107,14 +245,21 @@ public:
     inline void
     acquireBus()
     {
+        rtcnt_t request = SPIStatisticsRecorder::now();
+
 #if SPI_USE_MUTUAL_EXCLUSION
         ::spiAcquireBus(SPI::driver);
 #endif
+
+        // Without mutual exclusion, the wait time is always 0
+        _statistics.acquired(request);
     }
 
     inline void
     releaseBus()
     {
+        _statistics.released();
+
 #if SPI_USE_MUTUAL_EXCLUSION
         ::spiReleaseBus(SPI::driver);
 #endif
@@ -126,6 +271,7 @@ public:
     )
     {
         ::spiIgnore(SPI::driver, n);
+        _statistics.transferred(n);
     }
 
     inline void
@@ -136,6 +282,7 @@ public:
     )
     {
         ::spiExchange(SPI::driver, n, txbuf, rxbuf);
+        _statistics.transferred(n);
     }
 
     inline void
@@ -145,6 +292,7 @@ public:
     )
     {
         ::spiSend(SPI::driver, n, txbuf);
+        _statistics.transferred(n);
     }
 
     inline void
@@ -154,9 +302,48 @@ public:
     )
     {
         ::spiReceive(SPI::driver, n, rxbuf);
+        _statistics.transferred(n);
     }
+
+    /*! \brief Account a transfer made directly on the driver
+     *
+     * Used by SPIBatch_, that starts the transfers from ISR context.
+     */
+    static inline void
+    transferred(
+        size_t n
+    )
+    {
+        _statistics.transferred(n);
+    }
+
+#if CORE_HW_SPI_USE_STATISTICS
+    /*! \brief Get a snapshot of the bus statistics
+     *
+     */
+    static inline SPIStatistics
+    getStatistics()
+    {
+        return _statistics.get();
+    }
+
+    /*! \brief Reset the bus statistics
+     *
+     */
+    static inline void
+    resetStatistics()
+    {
+        _statistics.reset();
+    }
+#endif
+
+private:
+    static SPIStatisticsRecorder _statistics;
 };
 
+template <class _SPI>
+SPIStatisticsRecorder SPIMaster_<_SPI>::_statistics;
+
 class SPIDevice
 {
 public:
@@ -251,9 +438,11 @@ public:
         bool start = true
     )
     {
-#if SPI_USE_MUTUAL_EXCLUSION
-        ::spiAcquireBus(SPI::driver);
-#endif
+        rtcnt_t request = SPIStatisticsRecorder::now();
+
+        _master.acquireBus();
+
+        _statistics.acquired(request);
 
         if (start) {
             //   ::spiStart(SPI::driver, SPI::driver->config);
@@ -269,9 +458,9 @@ public:
             //    ::spiStop(SPI::driver);
         }
 
-#if SPI_USE_MUTUAL_EXCLUSION
-        ::spiReleaseBus(SPI::driver);
-#endif
+        _statistics.released();
+
+        _master.releaseBus();
     }
 
     inline void
@@ -279,7 +468,8 @@ public:
         size_t n
     )
     {
-        ::spiIgnore(SPI::driver, n);
+        _master.ignore(n);
+        _statistics.transferred(n);
     }
 
     inline void
@@ -289,7 +479,8 @@ public:
         void*       rxbuf
     )
     {
-        ::spiExchange(SPI::driver, n, txbuf, rxbuf);
+        _master.exchange(n, txbuf, rxbuf);
+        _statistics.transferred(n);
     }
 
     inline void
@@ -298,7 +489,8 @@ public:
         const void* txbuf
     )
     {
-        ::spiSend(SPI::driver, n, txbuf);
+        _master.send(n, txbuf);
+        _statistics.transferred(n);
     }
 
     inline void
@@ -307,14 +499,323 @@ public:
         void*  rxbuf
     )
     {
-        ::spiReceive(SPI::driver, n, rxbuf);
+        _master.receive(n, rxbuf);
+        _statistics.transferred(n);
     }
 
+    /*! \brief Device statistics recorder
+     *
+     * To account the SPIBatch_ transfers to this device.
+     */
+    static inline SPIStatisticsRecorder*
+    recorder()
+    {
+        return &_statistics;
+    }
+
+#if CORE_HW_SPI_USE_STATISTICS
+    /*! \brief Get a snapshot of the device statistics
+     *
+     */
+    static inline SPIStatistics
+    getStatistics()
+    {
+        return _statistics.get();
+    }
+
+    /*! \brief Reset the device statistics
+     *
+     */
+    static inline void
+    resetStatistics()
+    {
+        _statistics.reset();
+    }
+#endif
+
 private:
     static CS _cs;
     static SPIMaster_<SPI> _master;
+    static SPIStatisticsRecorder _statistics;
+};
+
+template <class _SPI, class _CS>
+typename SPIDevice_<_SPI, _CS>::CS SPIDevice_<_SPI, _CS>::_cs;
+
+template <class _SPI, class _CS>
+SPIMaster_<_SPI> SPIDevice_<_SPI, _CS>::_master;
+
+template <class _SPI, class _CS>
+SPIStatisticsRecorder SPIDevice_<_SPI, _CS>::_statistics;
+
+/*! \brief Scoped SPI transaction
+ *
+ * Acquires the bus and selects the device on construction, deselects the
+ * device and releases the bus on destruction.
+ */
+class SPITransaction
+{
+public:
+    SPITransaction(
+        SPIDevice& device
+    ) : _device(device)
+    {
+        _device.acquireBus();
+        _device.select();
+    }
+
+    ~SPITransaction()
+    {
+        _device.deselect();
+        _device.releaseBus();
+    }
+
+    SPITransaction(
+        const SPITransaction&
+    ) = delete;
+
+    SPITransaction&
+    operator=(
+        const SPITransaction&
+    ) = delete;
+
+private:
+    SPIDevice& _device;
 };
 
+/*! \brief Register transport over a SPI device
+ *
+ * To be used with RegisterMap_.
+ *
+ * \tparam _SPI SPIDriverTraits driver
+ * \tparam _CS chip select pad
+ * \tparam _READ bits set in the address byte for reads
+ * \tparam _INCREMENT bits set in the address byte for multi byte transfers
+ */
+template <class _SPI, class _CS, uint8_t _READ = 0x80, uint8_t _INCREMENT = 0x00>
+class SPIRegisterTransport_
+{
+public:
+    using Device = SPIDevice_<_SPI, _CS>;
+
+    static inline bool
+    read(
+        uint8_t     address,
+        void*       data,
+        std::size_t n
+    )
+    {
+        Device  device;
+        uint8_t command = address | _READ | ((n > 1) ? _INCREMENT : 0x00);
+
+        SPITransaction transaction(device);
+        device.send(1, &command);
+        device.receive(n, data);
+
+        return true;
+    }
+
+    static inline bool
+    write(
+        uint8_t     address,
+        const void* data,
+        std::size_t n
+    )
+    {
+        Device  device;
+        uint8_t command = (address & ~_READ) | ((n > 1) ? _INCREMENT : 0x00);
+
+        SPITransaction transaction(device);
+        device.send(1, &command);
+        device.send(n, data);
+
+        return true;
+    }
+};
+
+/*! \brief SPI transfer descriptor
+ *
+ */
+struct SPITransfer {
+    Pad*                   cs; //!< Chip select (nullptr for none)
+    std::size_t            n; //!< Number of frames
+    const void*            txbuf; //!< Transmit buffer (nullptr to receive only)
+    void*                  rxbuf; //!< Receive buffer (nullptr to transmit only)
+    bool                   hold; //!< Keep the device selected for the next transfer
+    systime_t              delay; //!< Delay before the next transfer, in system ticks
+    SPIStatisticsRecorder* device; //!< Device statistics, e.g. SPIDevice_::recorder() (nullptr for none)
+};
+
+/*! \brief SPI transfer list execution
+ *
+ * Runs a list of transfers within a single bus acquisition. Each transfer
+ * is started from the end of transfer interrupt of the previous one (or
+ * from a virtual timer, when a delay is requested); the calling thread is
+ * woken up only once, after the last transfer.
+ *
+ * The transfers are accounted in the bus statistics, and in the device
+ * statistics when the transfer references them.
+ *
+ * \tparam _SPI SPIDriverTraits driver
+ */
+template <class _SPI>
+class SPIBatch_
+{
+public:
+    using SPI = _SPI;
+    using Configuration = ::SPIConfig;
+
+    /*! \brief Run a transfer list
+     *
+     * The bus configuration is the one the driver has been started with.
+     */
+    static void
+    run(
+        const SPITransfer* transfers, //!< [in] transfer list
+        std::size_t        n //!< [in] number of transfers
+    )
+    {
+        if (n == 0) {
+            return;
+        }
+
+        SPIMaster_<SPI> master;
+
+        master.acquireBus();
+
+        if (!_initialized) {
+            chVTObjectInit(&_timer);
+            _initialized = true;
+        }
+
+        const Configuration* previous = SPI::driver->config;
+
+        // Same registers, only the end callback differs: no need to restart the driver
+        _configuration        = *previous;
+        _configuration.end_cb = _next;
+
+        _transfers = transfers;
+        _count     = n;
+        _index     = 0;
+
+        chSysLock();
+        SPI::driver->config = &_configuration;
+        _begin(transfers[0]);
+        osalThreadSuspendS(&_thread);
+        SPI::driver->config = previous;
+        chSysUnlock();
+
+        for (std::size_t i = 0; i < n; i++) {
+            master.transferred(transfers[i].n);
+
+            if (transfers[i].device != nullptr) {
+                transfers[i].device->transferred(transfers[i].n);
+            }
+        }
+
+        master.releaseBus();
+    } // run
+
+    template <std::size_t N>
+    static inline void
+    run(
+        const SPITransfer(&transfers)[N] //!< [in] transfer list
+    )
+    {
+        run(transfers, N);
+    }
+
+private:
+    static Configuration      _configuration;
+    static const SPITransfer* _transfers;
+    static std::size_t        _count;
+    static std::size_t        _index;
+    static thread_reference_t _thread;
+    static virtual_timer_t    _timer;
+    static bool               _initialized;
+
+    static inline void
+    _begin(
+        const SPITransfer& transfer
+    )
+    {
+        if (transfer.cs != nullptr) {
+            transfer.cs->clear();
+        }
+
+        if ((transfer.txbuf != nullptr) && (transfer.rxbuf != nullptr)) {
+            spiStartExchangeI(SPI::driver, transfer.n, transfer.txbuf, transfer.rxbuf);
+        } else if (transfer.txbuf != nullptr) {
+            spiStartSendI(SPI::driver, transfer.n, transfer.txbuf);
+        } else if (transfer.rxbuf != nullptr) {
+            spiStartReceiveI(SPI::driver, transfer.n, transfer.rxbuf);
+        } else {
+            spiStartIgnoreI(SPI::driver, transfer.n);
+        }
+    }
+
+    static void
+    _next(
+        SPIDriver* spip
+    )
+    {
+        (void)spip;
+
+        chSysLockFromISR();
+
+        const SPITransfer& transfer = _transfers[_index];
+
+        if ((transfer.cs != nullptr) && !transfer.hold) {
+            transfer.cs->set();
+        }
+
+        _index++;
+
+        if (_index == _count) {
+            osalThreadResumeI(&_thread, MSG_OK);
+        } else if (transfer.delay != 0) {
+            chVTSetI(&_timer, transfer.delay, _delayed, nullptr);
+        } else {
+            _begin(_transfers[_index]);
+        }
+
+        chSysUnlockFromISR();
+    } // _next
+
+    static void
+    _delayed(
+        void* p
+    )
+    {
+        (void)p;
+
+        chSysLockFromISR();
+        _begin(_transfers[_index]);
+        chSysUnlockFromISR();
+    }
+};
+
+template <class _SPI>
+typename SPIBatch_<_SPI>::Configuration SPIBatch_<_SPI>::_configuration;
+
+template <class _SPI>
+const SPITransfer * SPIBatch_<_SPI>::_transfers = nullptr;
+
+template <class _SPI>
+std::size_t SPIBatch_<_SPI>::_count = 0;
+
+template <class _SPI>
+std::size_t SPIBatch_<_SPI>::_index = 0;
+
+template <class _SPI>
+thread_reference_t SPIBatch_<_SPI>::_thread = nullptr;
+
+template <class _SPI>
+virtual_timer_t SPIBatch_<_SPI>::_timer;
+
+template <class _SPI>
+bool SPIBatch_<_SPI>::_initialized = false;
+
 // --- Aliases -----------------------------------------------------------------
 
 using SPI_1 = SPIDriverTraits<1>;
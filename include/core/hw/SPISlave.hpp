@@ -0,0 +1,315 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/hw/namespace.hpp>
+#include <core/hw/common.hpp>
+
+#include <core/hw/SPI.hpp>
+#include <core/hw/EXT.hpp>
+#include <core/hw/Delegate.hpp>
+
+#include <cstring>
+
+#include "hal.h"
+
+NAMESPACE_CORE_HW_BEGIN
+
+/*! \brief SPI slave
+ *
+ */
+class SPISlave
+{
+public:
+    using Configuration = ::SPIConfig;
+
+    /*! \brief Received frame
+     *
+     * The data is not copied out of the receive ring: it may span the end
+     * of the ring, in which case it is split in two segments.
+     */
+    struct Frame {
+        const uint8_t* data[2]; //!< Segments
+        std::size_t    size[2]; //!< Segment sizes
+
+        inline std::size_t
+        length() const
+        {
+            return size[0] + size[1];
+        }
+    };
+
+    /*! \brief Frame callback
+     *
+     * Invoked from ISR context when the master deasserts NSS.
+     */
+    using Callback = Delegate<void(const Frame&)>;
+
+public:
+    virtual void
+    start(
+        const Configuration& config
+    ) = 0;
+
+    virtual void
+    stop() = 0;
+
+    virtual void
+    setCallback(
+        Callback callback //!< callback function
+    ) = 0;
+
+    virtual void
+    resetCallback() = 0;
+
+    /*! \brief Preload the response to the next frame
+     *
+     * The response is shifted out starting from the next NSS assertion.
+     * Bytes past the end of the response are sent as zeros.
+     */
+    virtual void
+    setResponse(
+        const void* data, //!< [in] response
+        std::size_t n //!< [in] response size
+    ) = 0;
+
+    /*! \brief Preload the response to the next frame
+     *
+     * To be called from the frame callback.
+     */
+    virtual void
+    setResponseI(
+        const void* data, //!< [in] response
+        std::size_t n //!< [in] response size
+    ) = 0;
+};
+
+/*! \brief SPI slave with circular DMA buffers
+ *
+ * The peripheral is clocked and its DMA streams are allocated through the
+ * HAL driver, then it is switched to hardware NSS slave mode. Reception
+ * runs on a circular DMA ring; frames are delimited by the NSS rising edge,
+ * detected by the _NSS EXT channel (which must be configured for the rising
+ * edge of the NSS pad).
+ *
+ * At each frame boundary the peripheral is reset to flush its transmit
+ * data register, and the TX stream is re-armed on the latest preloaded
+ * response, so the reply does not depend on thread scheduling. The TX
+ * stream is not circular: it sends the response, zero padded to _TX_SIZE,
+ * and one more zero byte, which the peripheral then repeats on underrun
+ * until the end of the frame.
+ *
+ * \tparam _SPI SPIDriverTraits driver
+ * \tparam _NSS EXTChannel_ on the NSS pad
+ * \tparam _RX_SIZE size of the receive ring
+ * \tparam _TX_SIZE maximum response size
+ */
+template <class _SPI, class _NSS, std::size_t _RX_SIZE = 256, std::size_t _TX_SIZE = 64>
+class SPISlave_:
+    public SPISlave
+{
+public:
+    using SPI = _SPI;
+    using NSS = _NSS;
+
+public:
+    inline void
+    start(
+        const Configuration& config
+    )
+    {
+        ::spiStart(SPI::driver, &config);
+
+        _cr1 = config.cr1 & ~(SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_SPE);
+        _cr2 = (SPI::driver->spi->CR2 & ~SPI_CR2_SSOE) | SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+
+        _tail  = 0;
+        _front = 0;
+        _pending = false;
+        std::memset(_tx, 0, sizeof(_tx));
+
+        dmaStreamDisable(SPI::driver->dmarx);
+        dmaStreamSetPeripheral(SPI::driver->dmarx, &SPI::driver->spi->DR);
+        dmaStreamSetMemory0(SPI::driver->dmarx, _rx);
+        dmaStreamSetTransactionSize(SPI::driver->dmarx, _RX_SIZE);
+        dmaStreamSetMode(SPI::driver->dmarx, (SPI::driver->rxdmamode & ~STM32_DMA_CR_TCIE) | STM32_DMA_CR_MINC | STM32_DMA_CR_CIRC);
+        dmaStreamEnable(SPI::driver->dmarx);
+
+        chSysLock();
+        _configure();
+        chSysUnlock();
+
+        _nss.setCallback([](uint32_t) {
+            _frame();
+        });
+    } // start
+
+    inline void
+    stop()
+    {
+        _nss.resetCallback();
+
+        dmaStreamDisable(SPI::driver->dmarx);
+        dmaStreamDisable(SPI::driver->dmatx);
+        SPI::reset();
+
+        ::spiStop(SPI::driver);
+    }
+
+    inline void
+    setCallback(
+        Callback callback
+    )
+    {
+        _callback_impl = callback;
+    }
+
+    inline void
+    resetCallback()
+    {
+        _callback_impl = nullptr;
+    }
+
+    inline void
+    setResponse(
+        const void* data,
+        std::size_t n
+    )
+    {
+        chSysLock();
+        _pending = false;
+        chSysUnlock();
+
+        _fill(data, n);
+
+        chSysLock();
+        _pending = true;
+        chSysUnlock();
+    }
+
+    inline void
+    setResponseI(
+        const void* data,
+        std::size_t n
+    )
+    {
+        _fill(data, n);
+        _pending = true;
+    }
+
+private:
+    static NSS      _nss;
+    static Callback _callback_impl;
+    static uint32_t _cr1;
+    static uint32_t _cr2;
+    static uint8_t  _rx[_RX_SIZE];
+    static uint8_t  _tx[2][_TX_SIZE + 1];
+    static std::size_t   _tail;
+    static std::size_t   _front;
+    static volatile bool _pending;
+
+    static inline void
+    _fill(
+        const void* data,
+        std::size_t n
+    )
+    {
+        CORE_ASSERT(n <= _TX_SIZE);
+
+        uint8_t* back = _tx[_front ^ 1];
+
+        std::memcpy(back, data, n);
+        // Always zero terminated, see _configure()
+        std::memset(back + n, 0, _TX_SIZE + 1 - n);
+    }
+
+    static inline void
+    _configure()
+    {
+        SPI::driver->spi->CR1 = _cr1;
+        SPI::driver->spi->CR2 = _cr2;
+
+        dmaStreamDisable(SPI::driver->dmatx);
+        dmaStreamSetPeripheral(SPI::driver->dmatx, &SPI::driver->spi->DR);
+        dmaStreamSetMemory0(SPI::driver->dmatx, _tx[_front]);
+        dmaStreamSetTransactionSize(SPI::driver->dmatx, _TX_SIZE + 1);
+        dmaStreamSetMode(SPI::driver->dmatx, (SPI::driver->txdmamode & ~STM32_DMA_CR_TCIE) | STM32_DMA_CR_MINC);
+        dmaStreamEnable(SPI::driver->dmatx);
+
+        SPI::driver->spi->CR1 = _cr1 | SPI_CR1_SPE;
+    }
+
+    static void
+    _frame()
+    {
+        std::size_t head = _RX_SIZE - dmaStreamGetTransactionSize(SPI::driver->dmarx);
+
+        if (head == _RX_SIZE) {
+            head = 0;
+        }
+
+        Frame frame;
+
+        if (head >= _tail) {
+            frame.data[0] = &_rx[_tail];
+            frame.size[0] = head - _tail;
+            frame.data[1] = nullptr;
+            frame.size[1] = 0;
+        } else {
+            frame.data[0] = &_rx[_tail];
+            frame.size[0] = _RX_SIZE - _tail;
+            frame.data[1] = &_rx[0];
+            frame.size[1] = head;
+        }
+
+        _tail = head;
+
+        if (_callback_impl && (frame.length() > 0)) {
+            _callback_impl(frame);
+        }
+
+        chSysLockFromISR();
+
+        if (_pending) {
+            _front  ^= 1;
+            _pending = false;
+        }
+
+        SPI::reset();
+        _configure();
+        chSysUnlockFromISR();
+    } // _frame
+};
+
+template <class _SPI, class _NSS, std::size_t _RX_SIZE, std::size_t _TX_SIZE>
+_NSS SPISlave_<_SPI, _NSS, _RX_SIZE, _TX_SIZE>::_nss;
+
+template <class _SPI, class _NSS, std::size_t _RX_SIZE, std::size_t _TX_SIZE>
+SPISlave::Callback SPISlave_<_SPI, _NSS, _RX_SIZE, _TX_SIZE>::_callback_impl;
+
+template <class _SPI, class _NSS, std::size_t _RX_SIZE, std::size_t _TX_SIZE>
+uint32_t SPISlave_<_SPI, _NSS, _RX_SIZE, _TX_SIZE>::_cr1;
+
+template <class _SPI, class _NSS, std::size_t _RX_SIZE, std::size_t _TX_SIZE>
+uint32_t SPISlave_<_SPI, _NSS, _RX_SIZE, _TX_SIZE>::_cr2;
+
+template <class _SPI, class _NSS, std::size_t _RX_SIZE, std::size_t _TX_SIZE>
+uint8_t SPISlave_<_SPI, _NSS, _RX_SIZE, _TX_SIZE>::_rx[_RX_SIZE];
+
+template <class _SPI, class _NSS, std::size_t _RX_SIZE, std::size_t _TX_SIZE>
+uint8_t SPISlave_<_SPI, _NSS, _RX_SIZE, _TX_SIZE>::_tx[2][_TX_SIZE + 1];
+
+template <class _SPI, class _NSS, std::size_t _RX_SIZE, std::size_t _TX_SIZE>
+std::size_t SPISlave_<_SPI, _NSS, _RX_SIZE, _TX_SIZE>::_tail = 0;
+
+template <class _SPI, class _NSS, std::size_t _RX_SIZE, std::size_t _TX_SIZE>
+std::size_t SPISlave_<_SPI, _NSS, _RX_SIZE, _TX_SIZE>::_front = 0;
+
+template <class _SPI, class _NSS, std::size_t _RX_SIZE, std::size_t _TX_SIZE>
+volatile bool SPISlave_<_SPI, _NSS, _RX_SIZE, _TX_SIZE>::_pending = false;
+
+NAMESPACE_CORE_HW_END
@@ -0,0 +1,87 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/hw/namespace.hpp>
+#include <core/hw/common.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+NAMESPACE_CORE_HW_BEGIN
+
+/*! \brief Lock free value snapshot
+ *
+ * Sequence lock between a single writer, typically an ISR, and any number
+ * of readers running on the same core. The writer never waits; a reader
+ * retries if the value has been updated while it was being copied.
+ *
+ * \tparam _TYPE trivially copyable value type
+ */
+template <typename _TYPE>
+class Snapshot_
+{
+public:
+    using Type = _TYPE;
+
+    constexpr
+    Snapshot_() : _sequence(0), _value() {}
+
+    /*! \brief Publish a new value
+     *
+     * Not reentrant: there must be a single writer.
+     */
+    inline void
+    publish(
+        const Type& value
+    )
+    {
+        uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+
+        _sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        _value = value;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        _sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    /*! \brief Read a consistent copy of the last published value
+     *
+     * Must not be called from the writer context.
+     */
+    inline void
+    read(
+        Type& value
+    ) const
+    {
+        uint32_t begin;
+        uint32_t end;
+
+        do {
+            begin = _sequence.load(std::memory_order_acquire);
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            value = _value;
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            end = _sequence.load(std::memory_order_relaxed);
+        } while (((begin & 1) != 0) || (begin != end));
+    }
+
+    /*! \brief Number of values published so far
+     *
+     */
+    inline uint32_t
+    version() const
+    {
+        return _sequence.load(std::memory_order_acquire) >> 1;
+    }
+
+private:
+    std::atomic<uint32_t> _sequence;
+    Type                  _value;
+};
+
+NAMESPACE_CORE_HW_END
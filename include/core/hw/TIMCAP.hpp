@@ -9,7 +9,7 @@
 #include <core/hw/namespace.hpp>
 #include <core/hw/common.hpp>
 
-#include <functional>
+#include <core/hw/Delegate.hpp>
 
 #include "hal.h"
 #include "hal_timcap.h"
@@ -101,13 +101,22 @@ public:
 
     virtual void
     setOverflowCallback(
-    	std::function<void()>&& callback
+    	Delegate<void()> callback
     ) = 0;
 
     virtual void
 	resetOverflowCallback() = 0;
+
+    virtual void
+    begin() = 0;
+
+    virtual void
+    commit() = 0;
 };
 
+template <class _TIMCAP, std::size_t _CHANNEL>
+class TIMCAPChannel_;
+
 template <class _TIMCAP>
 class TIMCAPMaster_ : public TIMCAPMaster {
 public:
@@ -155,10 +164,10 @@ public:
 
      inline void
  	setOverflowCallback(
- 		std::function<void()>&& callback
+ 		Delegate<void()> callback
      )
      {
-     	_overflow_callback_impl = std::move(callback);
+     	_overflow_callback_impl = callback;
 
      	_configuration.overflow_cb = _overflow_callback;
      }
@@ -168,22 +177,155 @@ public:
      {
      	_configuration.overflow_cb = nullptr;
      }
- private:
-     Configuration _configuration;
 
-     static inline void
-     _overflow_callback(
-     	TIMCAPDriver *TIMCAPp
-     )
-     {
-     	_overflow_callback_impl();
-     }
+    /*! \brief Start a batch of channel changes
+     *
+     * Changes made by the TIMCAPChannel_ of this timer are staged until
+     * commit(), then applied all together. Only the bits touched by the
+     * staged changes are written, over the live register values.
+     *
+     * A batch must be opened and committed by a single thread, and must not
+     * span a call to start(), stop(), setFrequency(), enable() or disable().
+     */
+    inline void
+    begin()
+    {
+        chSysLock();
+        osalDbgAssert(!_batch, "batch already open");
+        _batch = true;
+        chSysUnlock();
+    }
+
+    /*! \brief Apply the staged channel changes
+     *
+     */
+    inline void
+    commit()
+    {
+        chSysLock();
+        osalDbgAssert(_batch, "no batch open");
+        _batch = false;
+        _apply();
+        chSysUnlock();
+    }
+
+private:
+    template <class, std::size_t>
+    friend class TIMCAPChannel_;
+
+    static const uint32_t CAPTURE_IE = STM32_TIM_DIER_CC1IE | STM32_TIM_DIER_CC2IE | STM32_TIM_DIER_CC3IE | STM32_TIM_DIER_CC4IE;
+
+    static Configuration _configuration;
+    static uint32_t      _ccmr_mask[2];
+    static uint32_t      _ccmr[2];
+    static uint32_t      _ccer_mask;
+    static uint32_t      _ccer;
+    static uint32_t      _dier_mask;
+    static uint32_t      _dier;
+    static bool          _batch;
+
+    static inline void
+    _overflow_callback(
+        TIMCAPDriver *TIMCAPp
+    )
+    {
+        _overflow_callback_impl();
+    }
+
+    static Delegate<void()> _overflow_callback_impl;
+
+    /*! \brief Change the register bits of a channel
+     *
+     * Applied immediately, or staged if a batch is open.
+     */
+    static void
+    _modify(
+        std::size_t channel,
+        uint32_t    ccmr_mask,
+        uint32_t    ccmr,
+        uint32_t    ccer_mask,
+        uint32_t    ccer,
+        uint32_t    dier_mask,
+        uint32_t    dier
+    )
+    {
+        chSysLock();
+
+        _ccmr_mask[channel / 2] |= ccmr_mask;
+        _ccmr[channel / 2]       = (_ccmr[channel / 2] & ~ccmr_mask) | ccmr;
+        _ccer_mask |= ccer_mask;
+        _ccer       = (_ccer & ~ccer_mask) | ccer;
+        _dier_mask |= dier_mask;
+        _dier       = (_dier & ~dier_mask) | dier;
+
+        if (!_batch) {
+            _apply();
+        }
 
-     static std::function<void()> _overflow_callback_impl;
+        chSysUnlock();
+    } // _modify
+
+    static inline bool
+    _isEnabled()
+    {
+        timcapstate_t state = TIMCAP::driver->state;
+
+        return (state != TIMCAP_UNINIT) && (state != TIMCAP_STOP) && (state != TIMCAP_READY);
+    }
+
+    static inline void
+    _apply()
+    {
+        stm32_tim_t* tim = TIMCAP::driver->tim;
+
+        // Input selection can only change while the channel is off
+        tim->CCER &= ~_ccer_mask;
+        tim->CCMR1 = (tim->CCMR1 & ~_ccmr_mask[0]) | _ccmr[0];
+        tim->CCMR2 = (tim->CCMR2 & ~_ccmr_mask[1]) | _ccmr[1];
+        tim->CCER |= _ccer;
+
+        // Otherwise, timcapEnable() sets the interrupts from the callbacks
+        if (_isEnabled()) {
+            uint32_t dier = (tim->DIER & ~_dier_mask) | _dier;
+
+            // Drop captures latched before the interrupt was enabled
+            tim->SR   = ~(dier & ~tim->DIER & CAPTURE_IE);
+            tim->DIER = dier;
+        }
+
+        _ccmr_mask[0] = _ccmr_mask[1] = 0;
+        _ccmr[0]      = _ccmr[1] = 0;
+        _ccer_mask    = _ccer = 0;
+        _dier_mask    = _dier = 0;
+    } // _apply
 };
 
 template <class _TIMCAP>
-std::function<void()>TIMCAPMaster_<_TIMCAP>::_overflow_callback_impl;
+typename TIMCAPMaster_<_TIMCAP>::Configuration TIMCAPMaster_<_TIMCAP>::_configuration;
+
+template <class _TIMCAP>
+uint32_t TIMCAPMaster_<_TIMCAP>::_ccmr_mask[2];
+
+template <class _TIMCAP>
+uint32_t TIMCAPMaster_<_TIMCAP>::_ccmr[2];
+
+template <class _TIMCAP>
+uint32_t TIMCAPMaster_<_TIMCAP>::_ccer_mask = 0;
+
+template <class _TIMCAP>
+uint32_t TIMCAPMaster_<_TIMCAP>::_ccer = 0;
+
+template <class _TIMCAP>
+uint32_t TIMCAPMaster_<_TIMCAP>::_dier_mask = 0;
+
+template <class _TIMCAP>
+uint32_t TIMCAPMaster_<_TIMCAP>::_dier = 0;
+
+template <class _TIMCAP>
+bool TIMCAPMaster_<_TIMCAP>::_batch = false;
+
+template <class _TIMCAP>
+Delegate<void()> TIMCAPMaster_<_TIMCAP>::_overflow_callback_impl;
 
 class TIMCAPChannel
 {
@@ -202,7 +344,7 @@ public:
 
     virtual void
     setPeriodCallback(
-    	std::function<void(uint32_t)>&& callback
+    	Delegate<void(uint32_t)> callback
     ) = 0;
 
     virtual void
@@ -218,43 +360,62 @@ public:
     using TIMCAP = _TIMCAP;
     const int CHANNEL = _CHANNEL;
 
+private:
+    using Master = TIMCAPMaster_<_TIMCAP>;
+
+    static const uint32_t IE = STM32_TIM_DIER_CC1IE << _CHANNEL;
+
 public:
+    /*! \brief Set the channel mode
+     *
+     * Only the channel bits are changed: the counter and the other
+     * channels keep running.
+     */
     inline void
     setMode(Mode mode)
     {
-		switch (mode) {
-		  case Mode::LOW:
-			  const_cast<Configuration*>(TIMCAP::driver->config)->modes[_CHANNEL] = TIMCAP_INPUT_ACTIVE_LOW;
-			  break;
-		  case Mode::HIGH:
-			  const_cast<Configuration*>(TIMCAP::driver->config)->modes[_CHANNEL] = TIMCAP_INPUT_ACTIVE_HIGH;
-			  break;
-		  default:
-			  const_cast<Configuration*>(TIMCAP::driver->config)->modes[_CHANNEL] = TIMCAP_INPUT_DISABLED;
-			  break;
-		}
-
-		::timcapStart(TIMCAP::driver, TIMCAP::driver->config);
-    }
+        const uint32_t ccmr_mask = STM32_TIM_CCMR1_CC1S_MASK << (8 * (_CHANNEL % 2));
+        const uint32_t ccmr      = STM32_TIM_CCMR1_CC1S(1) << (8 * (_CHANNEL % 2));
+        const uint32_t ccer_mask = (STM32_TIM_CCER_CC1E | STM32_TIM_CCER_CC1P) << (4 * _CHANNEL);
+
+        switch (mode) {
+          case Mode::LOW:
+              Master::_configuration.modes[_CHANNEL] = TIMCAP_INPUT_ACTIVE_LOW;
+              Master::_modify(_CHANNEL, ccmr_mask, ccmr, ccer_mask, ccer_mask, 0, 0);
+              break;
+          case Mode::HIGH:
+              Master::_configuration.modes[_CHANNEL] = TIMCAP_INPUT_ACTIVE_HIGH;
+              Master::_modify(_CHANNEL, ccmr_mask, ccmr, ccer_mask, STM32_TIM_CCER_CC1E << (4 * _CHANNEL), 0, 0);
+              break;
+          default:
+              Master::_configuration.modes[_CHANNEL] = TIMCAP_INPUT_DISABLED;
+              Master::_modify(_CHANNEL, 0, 0, ccer_mask, 0, 0, 0);
+              break;
+        }
+    } // setMode
 
     inline void
-	setPeriodCallback(
-		std::function<void(uint32_t)>&& callback
+    setPeriodCallback(
+        Delegate<void(uint32_t)> callback
     )
     {
-    	_capture_callback_impl = std::move(callback);
-
-    	const_cast<Configuration*>(TIMCAP::driver->config)->capture_cb_array[_CHANNEL] = _capture_callback;
+        chSysLock();
+        _capture_callback_impl = callback;
+        Master::_configuration.capture_cb_array[_CHANNEL] = _capture_callback;
+        chSysUnlock();
 
-		::timcapStart(TIMCAP::driver, TIMCAP::driver->config);
+        Master::_modify(_CHANNEL, 0, 0, 0, 0, IE, IE);
     }
 
     inline void
     resetPeriodCallback()
     {
-    	const_cast<Configuration*>(TIMCAP::driver->config)->capture_cb_array[_CHANNEL] = nullptr;
+        Master::_modify(_CHANNEL, 0, 0, 0, 0, IE, 0);
 
-		::timcapStart(TIMCAP::driver, TIMCAP::driver->config);
+        chSysLock();
+        _capture_callback_impl = nullptr;
+        Master::_configuration.capture_cb_array[_CHANNEL] = nullptr;
+        chSysUnlock();
     }
 
 private:
@@ -266,11 +427,11 @@ private:
     	_capture_callback_impl(timcap_lld_get_ccr(TIMCAPp, _CHANNEL));
     }
 
-    static std::function<void(uint32_t)> _capture_callback_impl;
+    static Delegate<void(uint32_t)> _capture_callback_impl;
 };
 
 template <class _TIMCAP, std::size_t _CHANNEL>
-std::function<void(uint32_t)>TIMCAPChannel_<_TIMCAP, _CHANNEL>::_capture_callback_impl;
+Delegate<void(uint32_t)> TIMCAPChannel_<_TIMCAP, _CHANNEL>::_capture_callback_impl;
 
 // --- Aliases -----------------------------------------------------------------
 
@@ -0,0 +1,180 @@
+/* COPYRIGHT (c) 2016-2018 Nova Labs SRL
+ *
+ * All rights reserved. All use of this software and documentation is
+ * subject to the License Agreement located in the file LICENSE.
+ */
+
+#pragma once
+
+#include <core/hw/namespace.hpp>
+#include <core/hw/common.hpp>
+
+#include <core/hw/PWMStream.hpp>
+
+#include "hal.h"
+
+NAMESPACE_CORE_HW_BEGIN
+
+#ifndef CORE_HW_WS2812_RESET_SLOTS
+#define CORE_HW_WS2812_RESET_SLOTS 240
+#endif
+
+/*! \brief WS2812 addressable LED strip
+ *
+ * Bits are encoded as compare values one half of the stream buffer at a
+ * time, from the refill interrupt, so no per bit buffer is needed and
+ * interrupts are never masked while sending.
+ *
+ * The PWM driver must run at 800 kHz (e.g. 72 MHz clock, 90 ticks
+ * period), with the channel active high. A 0 bit is one third of the
+ * period high, a 1 bit two thirds, and the frame is terminated by
+ * CORE_HW_WS2812_RESET_SLOTS low periods (300 us by default, recent parts
+ * need more than 280 us). The channel output is enabled by show().
+ *
+ * \tparam _STREAM PWMStream_ on the data channel
+ * \tparam _LEDS number of LEDs
+ */
+template <class _STREAM, std::size_t _LEDS>
+class WS2812_
+{
+public:
+    using STREAM = _STREAM;
+    using Sample = typename STREAM::Sample;
+
+    static const std::size_t LEDS = _LEDS;
+
+public:
+    /*! \brief Set a LED color
+     *
+     * Changes made while busy may show up in the frame being sent.
+     */
+    static inline void
+    set(
+        std::size_t index,
+        uint8_t     r,
+        uint8_t     g,
+        uint8_t     b
+    )
+    {
+        osalDbgCheck(index < _LEDS);
+
+        // Colors are sent in GRB order
+        _pixels[3 * index]     = g;
+        _pixels[3 * index + 1] = r;
+        _pixels[3 * index + 2] = b;
+    }
+
+    static inline void
+    clear()
+    {
+        for (std::size_t i = 0; i < sizeof(_pixels); i++) {
+            _pixels[i] = 0;
+        }
+    }
+
+    /*! \brief Send the colors to the strip
+     *
+     * Returns immediately, the frame is streamed in background.
+     *
+     * \return false if the previous frame is still being sent
+     */
+    static bool
+    show()
+    {
+        if (_busy) {
+            return false;
+        }
+
+        if (_started) {
+            STREAM::stop();
+        }
+
+        pwmcnt_t period = STREAM::PWM::driver->period;
+
+        // The stream only writes the compare register
+        if ((STREAM::PWM::driver->enabled & (1U << STREAM::CHANNEL)) == 0) {
+            pwmEnableChannel(STREAM::PWM::driver, STREAM::CHANNEL, 0);
+        }
+
+        _zero     = static_cast<Sample>(period / 3);
+        _one      = static_cast<Sample>((2 * period) / 3);
+        _position = 0;
+        _drain    = 0;
+        _busy     = true;
+        _started  = true;
+
+        STREAM::start(_refill);
+
+        return true;
+    }
+
+    /*! \brief Check if a frame is being sent
+     *
+     */
+    static inline bool
+    isBusy()
+    {
+        return _busy;
+    }
+
+private:
+    static const std::size_t BITS  = 24 * _LEDS;
+    static const std::size_t TOTAL = BITS + CORE_HW_WS2812_RESET_SLOTS;
+
+    static uint8_t       _pixels[3 * _LEDS];
+    static Sample        _zero;
+    static Sample        _one;
+    static std::size_t   _position;
+    static std::size_t   _drain;
+    static volatile bool _busy;
+    static bool          _started;
+
+    static void
+    _refill(
+        Sample*     buffer,
+        std::size_t n
+    )
+    {
+        if (_position >= TOTAL) {
+            // The other half holds the end of the frame: it has been sent
+            // when this is called again
+            if (++_drain == 2) {
+                STREAM::stopI();
+                _busy = false;
+                return;
+            }
+        }
+
+        for (std::size_t i = 0; i < n; i++, _position++) {
+            if (_position < BITS) {
+                uint8_t bit = _pixels[_position >> 3] & (0x80 >> (_position & 7));
+                buffer[i] = bit ? _one : _zero;
+            } else {
+                buffer[i] = 0;
+            }
+        }
+    } // _refill
+};
+
+template <class _STREAM, std::size_t _LEDS>
+uint8_t WS2812_<_STREAM, _LEDS>::_pixels[3 * _LEDS];
+
+template <class _STREAM, std::size_t _LEDS>
+typename WS2812_<_STREAM, _LEDS>::Sample WS2812_<_STREAM, _LEDS>::_zero = 0;
+
+template <class _STREAM, std::size_t _LEDS>
+typename WS2812_<_STREAM, _LEDS>::Sample WS2812_<_STREAM, _LEDS>::_one = 0;
+
+template <class _STREAM, std::size_t _LEDS>
+std::size_t WS2812_<_STREAM, _LEDS>::_position = 0;
+
+template <class _STREAM, std::size_t _LEDS>
+std::size_t WS2812_<_STREAM, _LEDS>::_drain = 0;
+
+template <class _STREAM, std::size_t _LEDS>
+volatile bool WS2812_<_STREAM, _LEDS>::_busy = false;
+
+template <class _STREAM, std::size_t _LEDS>
+bool WS2812_<_STREAM, _LEDS>::_started = false;
+
+NAMESPACE_CORE_HW_END